@@ -182,7 +182,7 @@ def mk_logger():
   if os.isatty(2):
     ch.setFormatter(cf)
   else:
-    ch.setFormatter(f)
+    ch.setFormatter(mk_formatter())
   log.addHandler(ch)
 
   return logging.getLogger(__name__)
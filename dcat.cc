@@ -6,13 +6,24 @@
 
 #include <string>
 #include <map>
+#include <array>
 #include <vector>
 #include <utility>
 #include <algorithm>
 #include <deque>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <new>
 
+#include <ctype.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -21,13 +32,47 @@
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <spawn.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+
+#ifdef HAVE_ZLIB
+    #include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+    #include <zstd.h>
+#endif
+#ifdef HAVE_LZMA
+    #include <lzma.h>
+#endif
+#ifdef HAVE_LZ4
+    #include <lz4frame.h>
+#endif
+#ifdef HAVE_BZIP2
+    #include <bzlib.h>
+#endif
+#ifdef HAVE_BROTLI
+    #include <brotli/decode.h>
+#endif
 
 using namespace std;
 
 struct Args {
     deque<const char*> filenames;
     bool read_from_stdin{false};
+    unsigned jobs{1};
+    bool mixed{false};
+    bool index{false};
+    bool range{false};
+    uint64_t range_off{0};
+    uint64_t range_len{UINT64_MAX};
+    size_t output_size{0};
+    bool exec{false};
 
     Args() {}
     Args(int argc, char **argv)
@@ -42,6 +87,45 @@ struct Args {
                     help(cout, argv[0]);
                     exit(0);
                 }
+                if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+                    if (i + 1 == argc) {
+                        cerr << "Argument missing for: " << argv[i] << '\n';
+                        exit(2);
+                    }
+                    ++i;
+                    parse_jobs(argv[i]);
+                    continue;
+                }
+                if (!strcmp(argv[i], "-m") || !strcmp(argv[i], "--mixed")) {
+                    mixed = true;
+                    continue;
+                }
+                if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--buffer")) {
+                    if (i + 1 == argc) {
+                        cerr << "Argument missing for: " << argv[i] << '\n';
+                        exit(2);
+                    }
+                    ++i;
+                    parse_size(argv[i]);
+                    continue;
+                }
+                if (!strcmp(argv[i], "--exec")) {
+                    exec = true;
+                    continue;
+                }
+                if (!strcmp(argv[i], "--index")) {
+                    index = true;
+                    continue;
+                }
+                if (!strcmp(argv[i], "--range")) {
+                    if (i + 1 == argc) {
+                        cerr << "Argument missing for: " << argv[i] << '\n';
+                        exit(2);
+                    }
+                    ++i;
+                    parse_range(argv[i]);
+                    continue;
+                }
                 if (argv[i][0] == '-') {
                     if (argv[i][1] == '-' && !argv[i][2]) {
                         look_for_option = false;
@@ -58,9 +142,68 @@ struct Args {
             cerr << "Can't mix - (stdin) with some filenames\n";
             exit(2);
         }
+        if ((index || range) && filenames.empty()) {
+            cerr << "--index and --range require a FILE\n";
+            exit(2);
+        }
+        if (range && filenames.size() != 1) {
+            cerr << "--range requires exactly one FILE\n";
+            exit(2);
+        }
         if (filenames.empty())
             read_from_stdin = true;
     }
+    // where 0 means: one per CPU
+    void parse_jobs(const char *s)
+    {
+        char *e = nullptr;
+        errno = 0;
+        unsigned long n = strtoul(s, &e, 10);
+        if (errno || !isdigit(*s) || *e || n > UINT_MAX) {
+            cerr << "Invalid number of jobs: " << s << '\n';
+            exit(2);
+        }
+        jobs = n;
+        if (!jobs)
+            jobs = thread::hardware_concurrency();
+        if (!jobs)
+            jobs = 1;
+    }
+    // i.e. with an optional K or M suffix
+    void parse_size(const char *s)
+    {
+        char *e = nullptr;
+        errno = 0;
+        output_size = strtoull(s, &e, 10);
+        switch (*e) {
+            case 'K': case 'k': output_size *= 1024; ++e; break;
+            case 'M': case 'm': output_size *= 1024 * 1024; ++e; break;
+        }
+        if (errno || !isdigit(*s) || *e || !output_size) {
+            cerr << "Invalid buffer size: " << s << '\n';
+            exit(2);
+        }
+    }
+    // i.e. OFFSET:LEN where LEN may be left out
+    void parse_range(const char *s)
+    {
+        char *e = nullptr;
+        errno = 0;
+        bool ok = isdigit(*s);
+        range_off = strtoull(s, &e, 10);
+        ok = ok && !errno && *e == ':';
+        if (ok && e[1]) {
+            const char *t = e + 1;
+            ok = isdigit(*t);
+            range_len = strtoull(t, &e, 10);
+            ok = ok && !errno && !*e;
+        }
+        if (!ok) {
+            cerr << "Invalid range: " << s << " (expected OFFSET:LEN)\n";
+            exit(2);
+        }
+        range = true;
+    }
     void help(ostream &o, const char *argv0)
     {
         o << "Usage: " << argv0 << " [OPTION]... [FILE]...\n"
@@ -71,7 +214,53 @@ struct Args {
             "the right helper. Reads from stdin when FILE is - or left out.\n"
             "\n"
             "Options:\n"
-            "  -h, --help    This help screen\n"
+            "  -h, --help          This help screen\n"
+            "  -j, --jobs N        Decompress up to N files concurrently (default: 1,\n"
+            "                      0: number of online CPUs), the output is still\n"
+            "                      written in the order of the arguments;\n"
+            "                      a single file that consists of independent\n"
+            "                      frames (multi-frame zstd, BGZF, multi-block xz)\n"
+            "                      is decompressed frame by frame concurrently\n"
+            "  -m, --mixed         Also look for compressed streams inside\n"
+            "                      uncompressed input, e.g. when gzip members\n"
+            "                      follow a plain text header\n"
+            "  -b, --buffer SIZE   Size of the output buffer (default: 128K),\n"
+            "                      buffers of 2M and more may use huge pages\n"
+            "      --exec          Always execute a helper (e.g. zcat) instead of\n"
+            "                      using a linked-in decoder\n"
+            "      --index         Write an index of checkpoints into FILE.dcx,\n"
+            "                      for gzip, BGZF and zstd files\n"
+            "      --range OFF:LEN Only write LEN uncompressed bytes starting at\n"
+            "                      OFF (LEN may be left out), decoding starts at\n"
+            "                      the preceding checkpoint\n"
+            "\n"
+            "Linked-in decoders:"
+#ifdef HAVE_ZLIB
+            " gzip"
+#endif
+#ifdef HAVE_ZSTD
+            " zstd"
+#endif
+#ifdef HAVE_LZMA
+            " xz lzma"
+    #if LZMA_VERSION >= 50040002
+            " lzip"
+    #endif
+#endif
+#ifdef HAVE_LZ4
+            " lz4"
+#endif
+#ifdef HAVE_BZIP2
+            " bzip2"
+#endif
+#ifdef HAVE_ZLIB
+            " zip"
+#endif
+#ifdef HAVE_BROTLI
+            " brotli"
+#endif
+            " snappy"
+            "\n"
             "\n";
     }
 
@@ -83,22 +272,36 @@ enum class Magic {
     ZSTANDARD,
     LZ4,
     XZ,
-    BZ2
+    BZ2,
+    LZMA,
+    LZIP,
+    ZIP,
+    BROTLI,
+    SNAPPY
 };
-static const map<Magic, const char*> magic2cat = {
-    { Magic::NONE     , "cat"     },
-    { Magic::GZIP     , "zcat"    },
-    { Magic::ZSTANDARD, "zstdcat" },
-    { Magic::LZ4      , "lz4cat"  },
-    { Magic::XZ       , "xzcat"   },
-    { Magic::BZ2      , "bzcat"   }
+// i.e. snappy is always decoded in-process
+static const map<Magic, vector<const char*>> magic2cat = {
+    { Magic::GZIP     , { "zcat"          } },
+    { Magic::ZSTANDARD, { "zstdcat"       } },
+    { Magic::LZ4      , { "lz4cat"        } },
+    { Magic::XZ       , { "xzcat"         } },
+    { Magic::BZ2      , { "bzcat"         } },
+    { Magic::LZMA     , { "lzcat"         } },
+    { Magic::LZIP     , { "lzip", "-dc"   } },
+    { Magic::ZIP      , { "funzip"        } },
+    { Magic::BROTLI   , { "brotli", "-dc" } }
 };
 static const vector<pair<vector<unsigned char>, Magic>> bytes2magic = {
     { { 0x1f, 0x8b                               }, Magic::GZIP },
     { { 0x28, 0xb5, 0x2f, 0xfd                   }, Magic::ZSTANDARD },
     { { 0x04, 0x22, 0x4d, 0x18                   }, Magic::LZ4 },
     { { 0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00 }, Magic::XZ },
-    { { 0x42, 0x5a, 0x68                         }, Magic::BZ2 }
+    { { 0x42, 0x5a, 0x68                         }, Magic::BZ2 },
+    // i.e. the usual properties (lc=3, lp=0, pb=2) of .lzma files
+    { { 0x5d, 0x00, 0x00                         }, Magic::LZMA },
+    { { 0x4c, 0x5a, 0x49, 0x50                   }, Magic::LZIP },
+    { { 0x50, 0x4b, 0x03, 0x04                   }, Magic::ZIP },
+    { { 0xff, 0x06, 0x00, 0x00, 0x73, 0x4e, 0x61, 0x50, 0x70, 0x59 }, Magic::SNAPPY }
 };
 
 static Magic detect_cat(const unsigned char *begin,
@@ -114,60 +317,2291 @@ static Magic detect_cat(const unsigned char *begin,
     return Magic::NONE;
 }
 
+// i.e. brotli streams don't start with a magic number,
+// thus, they are only detected by the file extension
+static Magic detect_file(const char *filename, const unsigned char *begin,
+        const unsigned char *end)
+{
+    Magic m = detect_cat(begin, end);
+    size_t n = strlen(filename);
+    if (m == Magic::NONE && n > 3 && !strcmp(filename + n - 3, ".br"))
+        m = Magic::BROTLI;
+    return m;
+}
+
+// i.e. the longest magic number is_magic() checks
+static const size_t max_magic_size = 13;
+
+// A stricter check than detect_cat() for finding the start of a
+// compressed stream inside uncompressed data, i.e. it also checks
+// some bytes following the magic number to avoid false positives.
+static bool is_magic(const unsigned char *p, size_t n)
+{
+    static const unsigned char bz2_block[] = { 0x31, 0x41, 0x59, 0x26, 0x53, 0x59 };
+    static const unsigned char bz2_eos[]   = { 0x17, 0x72, 0x45, 0x38, 0x50, 0x90 };
+    switch (n < 4 ? 0 : p[0]) {
+        case 0x1f: // i.e. deflate and no reserved flags
+            return p[1] == 0x8b && p[2] == 8 && !(p[3] & 0xe0);
+        case 0x5d: // i.e. .lzma files usually don't store the size
+            return n >= 13 && !p[1] && !p[2]
+                && all_of(p + 5, p + 13, [](unsigned char c) { return c == 0xff; });
+        case 'B':
+            return n >= 10 && p[1] == 'Z' && p[2] == 'h' && p[3] >= '1' && p[3] <= '9'
+                && (equal(bz2_block, bz2_block + 6, p + 4)
+                        || equal(bz2_eos, bz2_eos + 6, p + 4));
+        default:
+            return detect_cat(p, p + n) != Magic::NONE;
+    }
+}
+
+// Returns the start of the first compressed stream in [b, e), or a
+// position near e where a magic number might start that is completed
+// by the following input, or e.
+static const unsigned char *find_magic(const unsigned char *b,
+        const unsigned char *e, bool eof)
+{
+    for (const unsigned char *p = b; p < e; ++p) {
+        switch (*p) {
+            case 0x1f: case 0x28: case 0x04: case 0xfd: case 'B':
+            case 0x5d: case 'L': case 'P': case 0xff:
+                break;
+            default:
+                continue;
+        }
+        size_t n = e - p;
+        if (n < max_magic_size && !eof)
+            return p;
+        if (is_magic(p, n))
+            return p;
+    }
+    return e;
+}
+
+// i.e. large enough to amortize the syscall overhead
+static const size_t buffer_size = 128 * 1024;
+
+// i.e. the output of one file is kept in memory up to this size
+// when decompressing multiple files concurrently
+static const size_t spool_limit = 8 * 1024 * 1024;
+
+// i.e. tunables that are set once from the command line
+static size_t output_buffer_size = buffer_size;
+static bool   use_linked_in = true;
+
+static const size_t huge_page_size = 2 * 1024 * 1024;
+
+// i.e. page aligned and huge page aligned for large buffers, such
+// that they can be backed by transparent huge pages
+static unsigned char *alloc_aligned(size_t n)
+{
+    size_t a = n >= huge_page_size ? huge_page_size : size_t(sysconf(_SC_PAGESIZE));
+    size_t m = (n + a - 1) / a * a;
+    void *p = aligned_alloc(a, m);
+    if (!p)
+        throw bad_alloc();
+#ifdef MADV_HUGEPAGE
+    if (a == huge_page_size)
+        madvise(p, m, MADV_HUGEPAGE);
+#endif
+    return static_cast<unsigned char*>(p);
+}
+
+// Buffers the output of one file until it's its turn: in memory up
+// to a limit, the rest in an unlinked temporary file.
+class Spool {
+    public:
+        Spool(size_t limit = spool_limit);
+        void write(const unsigned char *p, size_t n);
+        // i.e. the temporary file, created on demand
+        int file();
+        void emit(int out, vector<unsigned char> &buf);
+    private:
+        vector<unsigned char> mem_;
+        size_t limit_ {0};
+        ixxx::util::FD file_;
+};
+
+// Collects decoded bytes and writes them out in large chunks.
+// Decoders directly decode into the free space of the buffer.
+class Output {
+    public:
+        Output(int fd = 1, size_t n = output_buffer_size);
+        unsigned char *ptr();
+        size_t avail() const;
+        void commit(size_t k);
+        void write(const unsigned char *p, size_t n);
+        void flush();
+        // i.e. nullptr for the file descriptor
+        void redirect(Spool *spool);
+        // i.e. drop the first skip bytes and everything after the next n
+        void limit(uint64_t skip, uint64_t n);
+        // i.e. the limit is reached
+        bool done() const;
+    private:
+        int fd_ {1};
+        Spool *spool_ {nullptr};
+        size_t cap_ {0};
+        unique_ptr<unsigned char, void(*)(void*)> buf_;
+        size_t n_ {0};
+        uint64_t skip_ {0};
+        uint64_t left_ {UINT64_MAX};
+};
+Output::Output(int fd, size_t n)
+    :
+        fd_(fd),
+        cap_(n),
+        buf_(alloc_aligned(n), free)
+{
+}
+unsigned char *Output::ptr()
+{
+    return buf_.get() + n_;
+}
+size_t Output::avail() const
+{
+    return cap_ - n_;
+}
+void Output::commit(size_t k)
+{
+    n_ += k;
+    if (n_ == cap_)
+        flush();
+}
+void Output::write(const unsigned char *p, size_t n)
+{
+    while (n) {
+        size_t k = min(n, avail());
+        memcpy(ptr(), p, k);
+        commit(k);
+        p += k;
+        n -= k;
+    }
+}
+void Output::flush()
+{
+    const unsigned char *p = buf_.get();
+    size_t n = n_;
+    n_ = 0;
+    if (skip_) {
+        size_t k = min(uint64_t(n), skip_);
+        p += k;
+        n -= k;
+        skip_ -= k;
+    }
+    n = min(uint64_t(n), left_);
+    left_ -= n;
+    if (spool_)
+        spool_->write(p, n);
+    else
+        ixxx::util::write_all(fd_, p, n);
+}
+void Output::redirect(Spool *spool)
+{
+    spool_ = spool;
+}
+void Output::limit(uint64_t skip, uint64_t n)
+{
+    skip_ = skip;
+    left_ = n;
+}
+bool Output::done() const
+{
+    return n_ >= skip_ && n_ - skip_ >= left_;
+}
+
+// A streaming decoder for one compression format.
+class Decoder {
+    public:
+        virtual ~Decoder();
+        // Decodes as much of the input as possible and returns the number
+        // of consumed bytes. Sets end when the end of a stream (i.e. member
+        // or frame) is reached, then the decoder must be reset before it
+        // can decode the next stream.
+        virtual size_t decode(const unsigned char *in, size_t n, Output &out,
+                bool &end) = 0;
+        virtual void reset() = 0;
+        // i.e. returns true if the data after the end of a stream still
+        // belongs to it, e.g. xz stream padding
+        virtual bool continues(const unsigned char *p, size_t n) const;
+        // i.e. returns true if the rest of the input is ignored after the
+        // end of a stream, e.g. zip members that can't be skipped without
+        // decoding them
+        virtual bool ignores_rest() const;
+};
+Decoder::~Decoder() = default;
+bool Decoder::continues(const unsigned char *, size_t) const
+{
+    return false;
+}
+bool Decoder::ignores_rest() const
+{
+    return false;
+}
+
+#ifdef HAVE_ZLIB
+class Gzip_Decoder : public Decoder {
+    public:
+        Gzip_Decoder();
+        ~Gzip_Decoder() override;
+        size_t decode(const unsigned char *in, size_t n, Output &out,
+                bool &end) override;
+        void reset() override;
+    private:
+        z_stream s {};
+};
+Gzip_Decoder::Gzip_Decoder()
+{
+    // i.e. 15 bits window size and expect a gzip header
+    if (inflateInit2(&s, 15 + 16) != Z_OK)
+        throw runtime_error("inflateInit2 failed");
+}
+Gzip_Decoder::~Gzip_Decoder()
+{
+    inflateEnd(&s);
+}
+size_t Gzip_Decoder::decode(const unsigned char *in, size_t n, Output &out,
+        bool &end)
+{
+    s.next_in = const_cast<unsigned char*>(in);
+    s.avail_in = n;
+    do {
+        s.next_out = out.ptr();
+        s.avail_out = out.avail();
+        int r = inflate(&s, Z_NO_FLUSH);
+        out.commit(out.avail() - s.avail_out);
+        if (r == Z_STREAM_END) {
+            end = true;
+            break;
+        }
+        if (r == Z_BUF_ERROR)
+            break;
+        if (r != Z_OK)
+            throw runtime_error(string("gzip: ") + (s.msg ? s.msg : "inflate failed"));
+    } while (s.avail_in || !s.avail_out);
+    return n - s.avail_in;
+}
+void Gzip_Decoder::reset()
+{
+    inflateReset(&s);
+}
+#endif
+
+#ifdef HAVE_ZSTD
+class Zstd_Decoder : public Decoder {
+    public:
+        Zstd_Decoder();
+        ~Zstd_Decoder() override;
+        size_t decode(const unsigned char *in, size_t n, Output &out,
+                bool &end) override;
+        void reset() override;
+    private:
+        ZSTD_DCtx *ctx {nullptr};
+};
+Zstd_Decoder::Zstd_Decoder()
+    :
+        ctx(ZSTD_createDCtx())
+{
+    if (!ctx)
+        throw runtime_error("ZSTD_createDCtx failed");
+}
+Zstd_Decoder::~Zstd_Decoder()
+{
+    ZSTD_freeDCtx(ctx);
+}
+size_t Zstd_Decoder::decode(const unsigned char *in, size_t n, Output &out,
+        bool &end)
+{
+    ZSTD_inBuffer ib = { in, n, 0 };
+    for (;;) {
+        ZSTD_outBuffer ob = { out.ptr(), out.avail(), 0 };
+        size_t r = ZSTD_decompressStream(ctx, &ob, &ib);
+        if (ZSTD_isError(r))
+            throw runtime_error(string("zstd: ") + ZSTD_getErrorName(r));
+        out.commit(ob.pos);
+        // i.e. frame completely decoded and flushed
+        if (!r) {
+            end = true;
+            break;
+        }
+        if (ib.pos == ib.size && ob.pos < ob.size)
+            break;
+    }
+    return ib.pos;
+}
+void Zstd_Decoder::reset()
+{
+    ZSTD_DCtx_reset(ctx, ZSTD_reset_session_only);
+}
+#endif
+
+#ifdef HAVE_LZMA
+// i.e. decodes .xz, .lzma and .lzip files
+class Lzma_Decoder : public Decoder {
+    public:
+        Lzma_Decoder(Magic format);
+        ~Lzma_Decoder() override;
+        size_t decode(const unsigned char *in, size_t n, Output &out,
+                bool &end) override;
+        void reset() override;
+        bool continues(const unsigned char *p, size_t n) const override;
+    private:
+        Magic format_;
+        const char *name_;
+        lzma_stream s = LZMA_STREAM_INIT;
+        bool started_ {false};
+};
+Lzma_Decoder::Lzma_Decoder(Magic format)
+    :
+        format_(format),
+        name_(format == Magic::XZ ? "xz" : format == Magic::LZMA ? "lzma" : "lzip")
+{
+    reset();
+}
+Lzma_Decoder::~Lzma_Decoder()
+{
+    lzma_end(&s);
+}
+size_t Lzma_Decoder::decode(const unsigned char *in, size_t n, Output &out,
+        bool &end)
+{
+    if (format_ == Magic::XZ && !started_) {
+        // i.e. skip the stream padding between concatenated streams
+        // such that it doesn't count as truncated stream at the end
+        size_t k = 0;
+        for (; k < n && !in[k]; ++k)
+            ;
+        if (k) {
+            end = true;
+            return k;
+        }
+        started_ = true;
+    }
+    s.next_in = in;
+    s.avail_in = n;
+    do {
+        s.next_out = out.ptr();
+        s.avail_out = out.avail();
+        lzma_ret r = lzma_code(&s, LZMA_RUN);
+        out.commit(out.avail() - s.avail_out);
+        if (r == LZMA_STREAM_END) {
+            end = true;
+            break;
+        }
+        if (r == LZMA_BUF_ERROR)
+            break;
+        if (r != LZMA_OK)
+            throw runtime_error(string(name_) + ": lzma_code failed (" + to_string(r) + ")");
+    } while (s.avail_in || !s.avail_out);
+    return n - s.avail_in;
+}
+void Lzma_Decoder::reset()
+{
+    lzma_ret r = LZMA_PROG_ERROR;
+    switch (format_) {
+        case Magic::XZ:   r = lzma_stream_decoder(&s, UINT64_MAX, 0); break;
+        case Magic::LZMA: r = lzma_alone_decoder(&s, UINT64_MAX); break;
+#if LZMA_VERSION >= 50040002
+        case Magic::LZIP: r = lzma_lzip_decoder(&s, UINT64_MAX, 0); break;
+#endif
+        default:
+            ;
+    }
+    if (r != LZMA_OK)
+        throw runtime_error(string(name_) + ": decoder initialization failed");
+    started_ = false;
+}
+bool Lzma_Decoder::continues(const unsigned char *p, size_t n) const
+{
+    return format_ == Magic::XZ && n && !*p;
+}
+#endif
+
+#ifdef HAVE_LZ4
+class Lz4_Decoder : public Decoder {
+    public:
+        Lz4_Decoder();
+        ~Lz4_Decoder() override;
+        size_t decode(const unsigned char *in, size_t n, Output &out,
+                bool &end) override;
+        void reset() override;
+    private:
+        LZ4F_dctx *ctx {nullptr};
+};
+Lz4_Decoder::Lz4_Decoder()
+{
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION)))
+        throw runtime_error("LZ4F_createDecompressionContext failed");
+}
+Lz4_Decoder::~Lz4_Decoder()
+{
+    LZ4F_freeDecompressionContext(ctx);
+}
+size_t Lz4_Decoder::decode(const unsigned char *in, size_t n, Output &out,
+        bool &end)
+{
+    size_t off = 0;
+    for (;;) {
+        size_t k = n - off;
+        size_t cap = out.avail();
+        size_t m = cap;
+        size_t r = LZ4F_decompress(ctx, out.ptr(), &m, in + off, &k, nullptr);
+        if (LZ4F_isError(r))
+            throw runtime_error(string("lz4: ") + LZ4F_getErrorName(r));
+        out.commit(m);
+        off += k;
+        // i.e. frame completely decoded and flushed
+        if (!r) {
+            end = true;
+            break;
+        }
+        if (off == n && m < cap)
+            break;
+    }
+    return off;
+}
+void Lz4_Decoder::reset()
+{
+    LZ4F_resetDecompressionContext(ctx);
+}
+#endif
+
+#ifdef HAVE_BZIP2
+class Bz2_Decoder : public Decoder {
+    public:
+        Bz2_Decoder();
+        ~Bz2_Decoder() override;
+        size_t decode(const unsigned char *in, size_t n, Output &out,
+                bool &end) override;
+        void reset() override;
+    private:
+        bz_stream s {};
+};
+Bz2_Decoder::Bz2_Decoder()
+{
+    if (BZ2_bzDecompressInit(&s, 0, 0) != BZ_OK)
+        throw runtime_error("BZ2_bzDecompressInit failed");
+}
+Bz2_Decoder::~Bz2_Decoder()
+{
+    BZ2_bzDecompressEnd(&s);
+}
+size_t Bz2_Decoder::decode(const unsigned char *in, size_t n, Output &out,
+        bool &end)
+{
+    s.next_in = reinterpret_cast<char*>(const_cast<unsigned char*>(in));
+    s.avail_in = n;
+    do {
+        s.next_out = reinterpret_cast<char*>(out.ptr());
+        s.avail_out = out.avail();
+        int r = BZ2_bzDecompress(&s);
+        out.commit(out.avail() - s.avail_out);
+        if (r == BZ_STREAM_END) {
+            end = true;
+            break;
+        }
+        if (r != BZ_OK)
+            throw runtime_error("bzip2: BZ2_bzDecompress failed (" + to_string(r) + ")");
+    } while (s.avail_in || !s.avail_out);
+    return n - s.avail_in;
+}
+void Bz2_Decoder::reset()
+{
+    BZ2_bzDecompressEnd(&s);
+    s = bz_stream {};
+    if (BZ2_bzDecompressInit(&s, 0, 0) != BZ_OK)
+        throw runtime_error("BZ2_bzDecompressInit failed");
+}
+#endif
+
+static uint32_t le32(const unsigned char *p)
+{
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16
+        | uint32_t(p[3]) << 24;
+}
+
+#ifdef HAVE_ZLIB
+// i.e. decodes the first member of a zip file (cf. APPNOTE.TXT) and
+// skips the following ones up to the end of the archive, as funzip does
+class Zip_Decoder : public Decoder {
+    public:
+        Zip_Decoder();
+        ~Zip_Decoder() override;
+        size_t decode(const unsigned char *in, size_t n, Output &out,
+                bool &end) override;
+        void reset() override;
+        bool continues(const unsigned char *p, size_t n) const override;
+        bool ignores_rest() const override;
+    private:
+        enum class State { HEADER, DEFLATED, STORED, DESCRIPTOR, SKIP };
+        // i.e. returns false until k bytes are collected in hdr_
+        bool collect(size_t k, const unsigned char *in, size_t n, size_t &off);
+        // i.e. the zip64 extended information extra field of the local header
+        const unsigned char *zip64_extra(size_t &len) const;
+        void start();
+        void finish(uint32_t crc);
+
+        z_stream s {};
+        State state_ {State::HEADER};
+        vector<unsigned char> hdr_;
+        uint16_t flags_ {0};
+        bool zip64_ {false};
+        uint32_t crc_ {0};
+        uint64_t left_ {0};
+        unsigned members_ {0};
+        bool ignore_rest_ {false};
+};
+Zip_Decoder::Zip_Decoder()
+{
+    if (inflateInit2(&s, -15) != Z_OK)
+        throw runtime_error("inflateInit2 failed");
+}
+Zip_Decoder::~Zip_Decoder()
+{
+    inflateEnd(&s);
+}
+bool Zip_Decoder::collect(size_t k, const unsigned char *in, size_t n, size_t &off)
+{
+    size_t m = min(k - min(k, hdr_.size()), n - off);
+    hdr_.insert(hdr_.end(), in + off, in + off + m);
+    off += m;
+    return hdr_.size() >= k;
+}
+const unsigned char *Zip_Decoder::zip64_extra(size_t &len) const
+{
+    const unsigned char *h = hdr_.data();
+    size_t nlen = h[26] | h[27] << 8, xlen = h[28] | h[29] << 8;
+    const unsigned char *x = h + 30 + nlen, *e = x + xlen;
+    while (x + 4 <= e) {
+        len = x[2] | x[3] << 8;
+        if (x + 4 + len > e)
+            break;
+        if (x[0] == 1 && !x[1])
+            return x + 4;
+        x += 4 + len;
+    }
+    return nullptr;
+}
+void Zip_Decoder::start()
+{
+    const unsigned char *h = hdr_.data();
+    flags_ = h[6] | h[7] << 8;
+    unsigned method = h[8] | h[9] << 8;
+    left_ = le32(h + 18);
+    size_t xlen = 0;
+    const unsigned char *x = zip64_extra(xlen);
+    // i.e. the data descriptor then contains 8 byte sizes
+    zip64_ = x || left_ == 0xffffffff;
+    crc_ = 0;
+    // i.e. the following members are skipped without decoding them,
+    // if their size is known upfront, otherwise the rest is ignored
+    if (++members_ > 1) {
+        if (flags_ & 8) {
+            ignore_rest_ = true;
+            return;
+        }
+        if (left_ == 0xffffffff) {
+            size_t k = le32(h + 22) == 0xffffffff ? 8 : 0;
+            if (!x || xlen < k + 8)
+                throw runtime_error("zip: zip64 extra field is missing");
+            left_ = le32(x + k) | uint64_t(le32(x + k + 4)) << 32;
+        }
+        state_ = State::SKIP;
+        return;
+    }
+    if (flags_ & 1)
+        throw runtime_error("zip: encrypted members aren't supported");
+    if (method == 8) {
+        inflateReset(&s);
+        state_ = State::DEFLATED;
+    } else if (method == 0) {
+        if (flags_ & 8)
+            throw runtime_error("zip: stored members with data descriptor aren't supported");
+        if (left_ == 0xffffffff && x && xlen >= 16)
+            left_ = le32(x + 8) | uint64_t(le32(x + 12)) << 32;
+        state_ = State::STORED;
+    } else {
+        throw runtime_error("zip: unsupported compression method " + to_string(method));
+    }
+}
+void Zip_Decoder::finish(uint32_t crc)
+{
+    if (crc != crc_)
+        throw runtime_error("zip: CRC mismatch");
+    hdr_.clear();
+    state_ = State::HEADER;
+}
+size_t Zip_Decoder::decode(const unsigned char *in, size_t n, Output &out,
+        bool &end)
+{
+    size_t off = 0;
+    while (off < n) {
+        switch (state_) {
+            case State::HEADER: {
+                if (!collect(4, in, n, off))
+                    break;
+                auto u16 = [this](size_t i) { return size_t(hdr_[i] | hdr_[i + 1] << 8); };
+                // i.e. the central directory records after the last member
+                // are skipped, up to the end of central directory record,
+                // which ends the stream
+                switch (le32(hdr_.data())) {
+                    case 0x04034b50: // i.e. local file header
+                        if (collect(30, in, n, off)
+                                && collect(30 + u16(26) + u16(28), in, n, off)) {
+                            start();
+                            if (ignore_rest_) {
+                                end = true;
+                                return off;
+                            }
+                        }
+                        break;
+                    case 0x02014b50: // i.e. central directory file header
+                        if (collect(46, in, n, off)
+                                && collect(46 + u16(28) + u16(30) + u16(32), in, n, off))
+                            hdr_.clear();
+                        break;
+                    case 0x06064b50: // i.e. zip64 end of central directory record
+                        if (collect(12, in, n, off)
+                                && collect(12 + le32(hdr_.data() + 4), in, n, off))
+                            hdr_.clear();
+                        break;
+                    case 0x07064b50: // i.e. zip64 end of central directory locator
+                        if (collect(20, in, n, off))
+                            hdr_.clear();
+                        break;
+                    case 0x06054b50: // i.e. end of central directory record
+                        if (collect(22, in, n, off) && collect(22 + u16(20), in, n, off)) {
+                            hdr_.clear();
+                            end = true;
+                            return off;
+                        }
+                        break;
+                    default:
+                        throw runtime_error("zip: unexpected signature");
+                }
+                break;
+            }
+            case State::DEFLATED: {
+                s.next_in = const_cast<unsigned char*>(in + off);
+                s.avail_in = n - off;
+                unsigned char *o = out.ptr();
+                s.next_out = o;
+                s.avail_out = out.avail();
+                int r = inflate(&s, Z_NO_FLUSH);
+                size_t k = out.avail() - s.avail_out;
+                crc_ = crc32(crc_, o, k);
+                out.commit(k);
+                off = n - s.avail_in;
+                if (r == Z_STREAM_END) {
+                    if (flags_ & 8) {
+                        hdr_.clear();
+                        state_ = State::DESCRIPTOR;
+                    } else {
+                        finish(le32(hdr_.data() + 14));
+                    }
+                } else if (r != Z_OK && r != Z_BUF_ERROR) {
+                    throw runtime_error(string("zip: ") + (s.msg ? s.msg : "inflate failed"));
+                }
+                break;
+            }
+            case State::STORED: {
+                size_t k = min(left_, uint64_t(n - off));
+                crc_ = crc32(crc_, in + off, k);
+                out.write(in + off, k);
+                off += k;
+                left_ -= k;
+                if (!left_)
+                    finish(le32(hdr_.data() + 14));
+                break;
+            }
+            case State::SKIP: {
+                size_t k = min(left_, uint64_t(n - off));
+                off += k;
+                left_ -= k;
+                if (!left_) {
+                    hdr_.clear();
+                    state_ = State::HEADER;
+                }
+                break;
+            }
+            case State::DESCRIPTOR:
+                // i.e. the signature is optional
+                if (!collect(4, in, n, off))
+                    break;
+                if (!memcmp(hdr_.data(), "PK\7\10", 4)) {
+                    if (!collect(zip64_ ? 24 : 16, in, n, off))
+                        break;
+                    finish(le32(hdr_.data() + 4));
+                } else {
+                    if (!collect(zip64_ ? 20 : 12, in, n, off))
+                        break;
+                    finish(le32(hdr_.data()));
+                }
+                break;
+        }
+    }
+    return off;
+}
+void Zip_Decoder::reset()
+{
+    hdr_.clear();
+    state_ = State::HEADER;
+    members_ = 0;
+    ignore_rest_ = false;
+}
+bool Zip_Decoder::continues(const unsigned char *p, size_t n) const
+{
+    return n >= 2 && p[0] == 'P' && p[1] == 'K';
+}
+bool Zip_Decoder::ignores_rest() const
+{
+    return ignore_rest_;
+}
+#endif
+
+#ifdef HAVE_BROTLI
+class Brotli_Decoder : public Decoder {
+    public:
+        Brotli_Decoder();
+        ~Brotli_Decoder() override;
+        size_t decode(const unsigned char *in, size_t n, Output &out,
+                bool &end) override;
+        void reset() override;
+    private:
+        BrotliDecoderState *st {nullptr};
+};
+Brotli_Decoder::Brotli_Decoder()
+{
+    reset();
+}
+Brotli_Decoder::~Brotli_Decoder()
+{
+    BrotliDecoderDestroyInstance(st);
+}
+size_t Brotli_Decoder::decode(const unsigned char *in, size_t n, Output &out,
+        bool &end)
+{
+    const uint8_t *next_in = in;
+    size_t avail_in = n;
+    for (;;) {
+        uint8_t *next_out = out.ptr();
+        size_t avail_out = out.avail();
+        BrotliDecoderResult r = BrotliDecoderDecompressStream(st, &avail_in, &next_in,
+                &avail_out, &next_out, nullptr);
+        out.commit(out.avail() - avail_out);
+        if (r == BROTLI_DECODER_RESULT_SUCCESS) {
+            end = true;
+            break;
+        }
+        if (r == BROTLI_DECODER_RESULT_ERROR)
+            throw runtime_error(string("brotli: ")
+                    + BrotliDecoderErrorString(BrotliDecoderGetErrorCode(st)));
+        if (r == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT)
+            break;
+    }
+    return n - avail_in;
+}
+void Brotli_Decoder::reset()
+{
+    if (st)
+        BrotliDecoderDestroyInstance(st);
+    st = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+    if (!st)
+        throw runtime_error("BrotliDecoderCreateInstance failed");
+}
+#endif
+
+static uint32_t crc32c(const unsigned char *p, size_t n)
+{
+    static const auto table = [] {
+        array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int j = 0; j < 8; ++j)
+                c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t c = 0xffffffff;
+    for (size_t i = 0; i < n; ++i)
+        c = table[(c ^ p[i]) & 0xff] ^ (c >> 8);
+    return ~c;
+}
+
+// i.e. the snappy framing format (cf. framing_format.txt of the
+// snappy sources), where each chunk is decoded on its own, thus,
+// it doesn't require the snappy library
+class Snappy_Decoder : public Decoder {
+    public:
+        size_t decode(const unsigned char *in, size_t n, Output &out,
+                bool &end) override;
+        void reset() override;
+        bool continues(const unsigned char *p, size_t n) const override;
+    private:
+        void chunk(const unsigned char *p, size_t n, Output &out);
+        void uncompress(const unsigned char *p, size_t n);
+
+        vector<unsigned char> chunk_;
+        vector<unsigned char> buf_;
+};
+void Snappy_Decoder::uncompress(const unsigned char *p, size_t n)
+{
+    auto corrupt = [] { return runtime_error("snappy: corrupt input"); };
+    uint64_t len = 0;
+    size_t i = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+        if (i == n || shift > 28)
+            throw corrupt();
+        len |= uint64_t(p[i] & 0x7f) << shift;
+        if (!(p[i++] & 0x80))
+            break;
+    }
+    // i.e. the framing format limits chunks to 64 KiB
+    if (len > 64 * 1024)
+        throw corrupt();
+    buf_.resize(len);
+    size_t k = 0;
+    while (i < n) {
+        unsigned tag = p[i++];
+        size_t l = 0, off = 0;
+        switch (tag & 3) {
+            case 0: // i.e. literal
+                l = tag >> 2;
+                if (l >= 60) {
+                    size_t m = l - 59;
+                    if (n - i < m)
+                        throw corrupt();
+                    l = 0;
+                    for (size_t j = 0; j < m; ++j)
+                        l |= size_t(p[i + j]) << (8 * j);
+                    i += m;
+                }
+                ++l;
+                if (n - i < l || len - k < l)
+                    throw corrupt();
+                memcpy(buf_.data() + k, p + i, l);
+                i += l;
+                k += l;
+                continue;
+            case 1:
+                if (i == n)
+                    throw corrupt();
+                l = 4 + ((tag >> 2) & 7);
+                off = (tag >> 5) << 8 | p[i++];
+                break;
+            case 2:
+                if (n - i < 2)
+                    throw corrupt();
+                l = 1 + (tag >> 2);
+                off = p[i] | p[i + 1] << 8;
+                i += 2;
+                break;
+            default:
+                if (n - i < 4)
+                    throw corrupt();
+                l = 1 + (tag >> 2);
+                off = le32(p + i);
+                i += 4;
+        }
+        if (!off || off > k || len - k < l)
+            throw corrupt();
+        // i.e. the source may overlap with the destination
+        for (size_t j = 0; j < l; ++j, ++k)
+            buf_[k] = buf_[k - off];
+    }
+    if (k != len)
+        throw corrupt();
+}
+void Snappy_Decoder::chunk(const unsigned char *p, size_t n, Output &out)
+{
+    unsigned type = p[0];
+    p += 4;
+    n -= 4;
+    if (type == 0xff) {
+        if (n != 6 || memcmp(p, "sNaPpY", 6))
+            throw runtime_error("snappy: invalid stream identifier");
+        return;
+    }
+    if (type > 1) {
+        if (type < 0x80)
+            throw runtime_error("snappy: unskippable chunk type " + to_string(type));
+        return;
+    }
+    if (n < 4)
+        throw runtime_error("snappy: truncated chunk");
+    const unsigned char *d = p + 4;
+    size_t m = n - 4;
+    if (!type) {
+        uncompress(p + 4, n - 4);
+        d = buf_.data();
+        m = buf_.size();
+    }
+    uint32_t c = crc32c(d, m);
+    if (((c >> 15) | (c << 17)) + 0xa282ead8 != le32(p))
+        throw runtime_error("snappy: CRC mismatch");
+    out.write(d, m);
+}
+size_t Snappy_Decoder::decode(const unsigned char *in, size_t n, Output &out,
+        bool &end)
+{
+    size_t off = 0;
+    while (off < n) {
+        // i.e. return to the caller at something that isn't a chunk,
+        // e.g. the next stream of a different format
+        if (chunk_.empty() && !continues(in + off, n - off)) {
+            if (!off)
+                throw runtime_error("snappy: unskippable chunk type "
+                        + to_string(in[off]));
+            break;
+        }
+        if (chunk_.empty() && n - off >= 4) {
+            size_t len = 4 + (le32(in + off) >> 8);
+            // i.e. the usual case, the complete chunk is available
+            if (n - off >= len) {
+                chunk(in + off, len, out);
+                off += len;
+                continue;
+            }
+        }
+        size_t k = min(4 - min(size_t(4), chunk_.size()), n - off);
+        chunk_.insert(chunk_.end(), in + off, in + off + k);
+        off += k;
+        if (chunk_.size() < 4)
+            break;
+        size_t len = 4 + (le32(chunk_.data()) >> 8);
+        k = min(len - chunk_.size(), n - off);
+        chunk_.insert(chunk_.end(), in + off, in + off + k);
+        off += k;
+        if (chunk_.size() < len)
+            break;
+        chunk(chunk_.data(), len, out);
+        chunk_.clear();
+    }
+    // i.e. the framing format has no end marker
+    end = chunk_.empty();
+    return off;
+}
+void Snappy_Decoder::reset()
+{
+    chunk_.clear();
+}
+bool Snappy_Decoder::continues(const unsigned char *p, size_t n) const
+{
+    return n && (p[0] < 2 || p[0] >= 0x80);
+}
+
+// Creates the decoders on demand and reuses them for all files.
+class Decoders {
+    public:
+        // returns nullptr if there is no linked-in decoder for the format,
+        // i.e. the helper has to be executed, instead
+        Decoder *get(Magic magic);
+    private:
+        map<Magic, unique_ptr<Decoder>> decoders_;
+};
+Decoder *Decoders::get(Magic magic)
+{
+    if (!use_linked_in && magic2cat.count(magic))
+        return nullptr;
+    auto &d = decoders_[magic];
+    if (d) {
+        d->reset();
+        return d.get();
+    }
+    switch (magic) {
+#ifdef HAVE_ZLIB
+        case Magic::GZIP:      d.reset(new Gzip_Decoder()); break;
+#endif
+#ifdef HAVE_ZSTD
+        case Magic::ZSTANDARD: d.reset(new Zstd_Decoder()); break;
+#endif
+#ifdef HAVE_LZMA
+        case Magic::XZ:
+        case Magic::LZMA:      d.reset(new Lzma_Decoder(magic)); break;
+    #if LZMA_VERSION >= 50040002
+        case Magic::LZIP:      d.reset(new Lzma_Decoder(magic)); break;
+    #endif
+#endif
+#ifdef HAVE_LZ4
+        case Magic::LZ4:       d.reset(new Lz4_Decoder()); break;
+#endif
+#ifdef HAVE_BZIP2
+        case Magic::BZ2:       d.reset(new Bz2_Decoder()); break;
+#endif
+#ifdef HAVE_ZLIB
+        case Magic::ZIP:       d.reset(new Zip_Decoder()); break;
+#endif
+#ifdef HAVE_BROTLI
+        case Magic::BROTLI:    d.reset(new Brotli_Decoder()); break;
+#endif
+        case Magic::SNAPPY:    d.reset(new Snappy_Decoder()); break;
+        default:
+            ;
+    }
+    return d.get();
+}
+
+// i.e. the complete file is mapped read-only
+class Mapped_File {
+    public:
+        Mapped_File(int fd);
+        ~Mapped_File();
+        Mapped_File(const Mapped_File &) = delete;
+        Mapped_File &operator=(const Mapped_File &) = delete;
+        const unsigned char *data() const;
+        size_t size() const;
+        // i.e. read ahead aggressively and use huge pages, if possible
+        void sequential();
+    private:
+        void   *p_ {nullptr};
+        size_t  n_ {0};
+};
+Mapped_File::Mapped_File(int fd)
+{
+    struct stat st;
+    ixxx::posix::fstat(fd, &st);
+    n_ = st.st_size;
+    if (n_)
+        p_ = ixxx::posix::mmap(nullptr, n_, PROT_READ, MAP_PRIVATE, fd, 0);
+}
+Mapped_File::~Mapped_File()
+{
+    if (p_)
+        munmap(p_, n_);
+}
+const unsigned char *Mapped_File::data() const
+{
+    return static_cast<const unsigned char*>(p_);
+}
+size_t Mapped_File::size() const
+{
+    return n_;
+}
+void Mapped_File::sequential()
+{
+    if (!p_)
+        return;
+    // i.e. just hints, MADV_HUGEPAGE fails unless the kernel supports
+    // huge pages for the page cache of the filesystem
+    madvise(p_, n_, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(p_, n_, MADV_HUGEPAGE);
+#endif
+}
+
+// The input of a decoder, either read from a file descriptor into a
+// buffer or a complete mapping.
+class Input {
+    public:
+        // i.e. the first n bytes were already read into buf
+        Input(int fd, vector<unsigned char> &buf, size_t n);
+        Input(const unsigned char *p, size_t n);
+        const unsigned char *begin() const;
+        const unsigned char *end() const;
+        size_t size() const;
+        void consume(size_t k);
+        // Reads more input while keeping the unconsumed bytes.
+        // Returns false at the end of the input.
+        bool fill();
+        bool eof() const;
+    private:
+        int fd_ {-1};
+        unsigned char *buf_ {nullptr};
+        size_t cap_ {0};
+        const unsigned char *p_ {nullptr};
+        size_t n_ {0};
+        size_t off_ {0};
+        bool eof_ {false};
+};
+Input::Input(int fd, vector<unsigned char> &buf, size_t n)
+    :
+        fd_(fd),
+        buf_(buf.data()),
+        cap_(buf.size()),
+        p_(buf.data()),
+        n_(n)
+{
+}
+Input::Input(const unsigned char *p, size_t n)
+    :
+        p_(p),
+        n_(n),
+        eof_(true)
+{
+}
+const unsigned char *Input::begin() const
+{
+    return p_ + off_;
+}
+const unsigned char *Input::end() const
+{
+    return p_ + n_;
+}
+size_t Input::size() const
+{
+    return n_ - off_;
+}
+void Input::consume(size_t k)
+{
+    off_ += k;
+}
+bool Input::fill()
+{
+    if (eof_)
+        return false;
+    if (off_) {
+        memmove(buf_, buf_ + off_, n_ - off_);
+        n_ -= off_;
+        off_ = 0;
+    }
+    if (n_ == cap_)
+        return true;
+    size_t k = ixxx::posix::read(fd_, buf_ + n_, cap_ - n_);
+    n_ += k;
+    eof_ = !k;
+    return k;
+}
+bool Input::eof() const
+{
+    return eof_;
+}
+
+// Decodes the input. Concatenated streams (e.g. the members of a gzip
+// file) are decoded one after another, as zcat etc. do. The format is
+// detected again at each stream boundary, i.e. the streams may use
+// different formats. With mixed, uncompressed parts are copied through
+// while they are scanned for the start of the next compressed stream.
+// The format of the first stream is detected unless magic is given.
+static void decode(Decoders &decoders, Input &&in, Output &out, bool mixed,
+        Magic magic = Magic::NONE)
+{
+    Decoder *d = magic == Magic::NONE ? nullptr : decoders.get(magic);
+    bool plain = false;
+    bool boundary = !d;
+    bool pending = false;
+    for (;;) {
+        if (out.done())
+            return;
+        if (boundary) {
+            // i.e. complete a magic number that straddles the read boundary
+            while (in.size() < max_magic_size && in.fill())
+                ;
+            if (!in.size())
+                break;
+            const unsigned char *p = in.begin();
+            Magic m = detect_cat(p, in.end());
+            if (plain && !is_magic(p, in.size()))
+                m = Magic::NONE;
+            if (m != Magic::NONE) {
+                d = decoders.get(m);
+                if (!d)
+                    throw runtime_error(string("can't switch to ") + magic2cat.at(m).front()
+                            + " format in the middle of the input");
+                magic = m;
+                plain = false;
+            } else if (mixed && !(d && !plain && d->continues(p, in.size()))) {
+                plain = true;
+            } else if (!d) {
+                throw runtime_error("unknown format");
+            }
+            // else: i.e. the current decoder has to deal with it,
+            // e.g. xz stream padding, a zip central directory or garbage
+            boundary = false;
+        }
+        if (!in.size() && !in.fill())
+            break;
+        if (plain) {
+            const unsigned char *p = in.begin();
+            const unsigned char *e = find_magic(p, in.end(), in.eof());
+            out.write(p, e - p);
+            in.consume(e - p);
+            boundary = in.size();
+        } else {
+            bool end = false;
+            in.consume(d->decode(in.begin(), in.size(), out, end));
+            pending = !end;
+            if (end && d->ignores_rest()) {
+                do
+                    in.consume(in.size());
+                while (in.fill());
+                break;
+            }
+            if (end) {
+                d->reset();
+                boundary = true;
+            }
+        }
+    }
+    if (pending)
+        throw runtime_error("unexpected end of compressed input");
+}
+
+// i.e. a regular file is mapped and decoded directly from the mapping
+static void decode_file(Decoders &decoders, int fd, vector<unsigned char> &buf,
+        size_t n, Output &out, bool mixed, Magic magic)
+{
+    struct stat st;
+    ixxx::posix::fstat(fd, &st);
+    if (S_ISREG(st.st_mode)) {
+        Mapped_File f(fd);
+        f.sequential();
+        decode(decoders, Input(f.data(), f.size()), out, mixed, magic);
+    } else {
+        decode(decoders, Input(fd, buf, n), out, mixed, magic);
+    }
+}
+
+enum class Copy {
+    COPY_FILE_RANGE,
+    SENDFILE,
+    SPLICE,
+    READ_WRITE
+};
+
+static Copy copy_method(int in, int out)
+{
+    struct stat a, b;
+    ixxx::posix::fstat(in, &a);
+    ixxx::posix::fstat(out, &b);
+    if (S_ISFIFO(a.st_mode) || S_ISFIFO(b.st_mode))
+        return Copy::SPLICE;
+    if (S_ISREG(a.st_mode) && S_ISREG(b.st_mode))
+        return Copy::COPY_FILE_RANGE;
+    if (S_ISREG(a.st_mode))
+        return Copy::SENDFILE;
+    return Copy::READ_WRITE;
+}
+
+// Copies the remaining input as is, i.e. without copying it through
+// user space, if possible. Falls back to the next method where the
+// kernel doesn't support the combination of file descriptors
+// (e.g. copy_file_range() across file systems on old kernels,
+// an O_APPEND stdout etc.).
+static void passthrough(int in, int out, vector<unsigned char> &buf)
+{
+    // i.e. as much as possible, the kernel copies less if it wants to
+    const size_t n = 1 << 30;
+    Copy m = copy_method(in, out);
+    for (;;) {
+        ssize_t r = 0;
+        switch (m) {
+            case Copy::COPY_FILE_RANGE:
+                r = copy_file_range(in, nullptr, out, nullptr, n, 0);
+                break;
+            case Copy::SENDFILE:
+                r = sendfile(out, in, nullptr, n);
+                break;
+            case Copy::SPLICE:
+                r = splice(in, nullptr, out, nullptr, n, SPLICE_F_MOVE);
+                break;
+            case Copy::READ_WRITE:
+                r = ixxx::posix::read(in, buf.data(), buf.size());
+                ixxx::util::write_all(out, buf.data(), r);
+                break;
+        }
+        if (r == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EINVAL || errno == ENOSYS || errno == EXDEV
+                    || errno == EOPNOTSUPP
+                    || (errno == EBADF && m == Copy::COPY_FILE_RANGE)) {
+                m = m == Copy::COPY_FILE_RANGE ? Copy::SENDFILE : Copy::READ_WRITE;
+                continue;
+            }
+            throw system_error(errno, generic_category(), "passthrough");
+        }
+        if (!r)
+            break;
+    }
+}
+
+Spool::Spool(size_t limit)
+    :
+        limit_(limit)
+{
+}
+void Spool::write(const unsigned char *p, size_t n)
+{
+    size_t k = min(n, limit_ - mem_.size());
+    mem_.insert(mem_.end(), p, p + k);
+    if (k < n)
+        ixxx::util::write_all(file(), p + k, n - k);
+}
+int Spool::file()
+{
+    if (file_.get() == -1) {
+        const char *dir = getenv("TMPDIR");
+        file_ = ixxx::util::FD(dir ? dir : "/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC,
+                0600);
+    }
+    return file_;
+}
+void Spool::emit(int out, vector<unsigned char> &buf)
+{
+    ixxx::util::write_all(out, mem_.data(), mem_.size());
+    if (file_.get() != -1) {
+        ixxx::posix::lseek(file_, 0, SEEK_SET);
+        passthrough(file_, out, buf);
+    }
+}
+
+// i.e. the first n bytes were already read into buf
+static void cat_plain(int fd, vector<unsigned char> &buf, size_t n, Output &out)
+{
+    out.flush();
+    ixxx::util::write_all(1, buf.data(), n);
+    passthrough(fd, 1, buf);
+}
+
+extern char **environ;
+
+static vector<char*> helper_argv(Magic magic)
+{
+    vector<char*> v;
+    for (auto s : magic2cat.at(magic))
+        v.push_back(const_cast<char*>(s));
+    v.push_back(nullptr);
+    return v;
+}
+
 static void exec_cat(Magic magic)
 {
-    const char *s = magic2cat.at(magic);
-    char *v[2];
-    v[0] = const_cast<char*>(s);
-    v[1] = nullptr;
-    ixxx::posix::execvp(s, v);
+    auto v = helper_argv(magic);
+    ixxx::posix::execvp(v[0], v.data());
 }
 
-static void cat_file(const char *filename)
+static void exec_file(int fd, Magic magic)
 {
-    int fd = ixxx::posix::open(filename, O_RDONLY);
-    vector<unsigned char> v(8);
-    ixxx::util::read_all(fd, v);
-    Magic magic = detect_cat(&*v.begin(), &*v.end());
     ixxx::posix::lseek(fd, 0, SEEK_SET);
     ixxx::posix::dup2(fd, 0);
     exec_cat(magic);
 }
 
-static void cat_files(const deque<const char*> &filenames)
+static void wait_cat(int pid, const char *filename)
+{
+    siginfo_t info;
+    ixxx::posix::waitid(P_PID, pid, &info, WEXITED);
+    if (info.si_code == CLD_EXITED) {
+        if (info.si_status)
+            throw runtime_error("decompress failed ("
+                    + string(filename) + " => "
+                    + to_string(info.si_status) + ")");
+    } else {
+        if (info.si_status == SIGPIPE) {
+            raise(SIGPIPE);
+        } else {
+            throw runtime_error("decompress command terminated by a signal ("
+                    + string(filename) + " => "
+                    + to_string(info.si_status) + ")");
+        }
+    }
+}
+
+// Formats with a linked-in decoder are decoded in-process,
+// for the others a helper is executed (in a child process,
+// unless it's just one file).
+static void cat_files(const deque<const char*> &filenames, bool mixed)
 {
+    Decoders decoders;
+    Output out;
+    vector<unsigned char> buf(buffer_size);
     for (auto filename : filenames) {
+        ixxx::util::FD fd(filename, O_RDONLY);
+        size_t n = ixxx::util::read_all(fd, buf.data(), max_magic_size);
+        Magic magic = detect_file(filename, buf.data(), buf.data() + n);
+        if (magic == Magic::NONE && !mixed) {
+            cat_plain(fd, buf, n, out);
+            continue;
+        }
+        if (magic == Magic::NONE || decoders.get(magic)) {
+            try {
+                decode_file(decoders, fd, buf, n, out, mixed, magic);
+            } catch (const exception &e) {
+                out.flush();
+                throw runtime_error(string(filename) + ": " + e.what());
+            }
+            continue;
+        }
+        out.flush();
+        if (filenames.size() == 1)
+            exec_file(fd, magic);
         int pid = ixxx::posix::fork();
         if (pid == 0) { // child
-            cat_file(filename);
+            exec_file(fd, magic);
         } else { // parent
-            siginfo_t info;
-            ixxx::posix::waitid(P_PID, pid, &info, WEXITED);
-            if (info.si_code == CLD_EXITED) {
-                if (info.si_status)
-                    throw runtime_error("decompress failed ("
-                            + string(filename) + " => "
-                            + to_string(info.si_status) + ")");
-            } else {
-                if (info.si_status == SIGPIPE) {
-                    raise(SIGPIPE);
-                } else {
-                    throw runtime_error("decompress command terminated by a signal ("
-                            + string(filename) + " => "
-                            + to_string(info.si_status) + ")");
+            wait_cat(pid, filename);
+        }
+    }
+    out.flush();
+}
+
+// the state of one worker thread, reused for all its tasks
+struct Worker {
+    Decoders              decoders;
+    vector<unsigned char> buf = vector<unsigned char>(buffer_size);
+    Output                out;
+};
+
+// Executes k tasks on n worker threads and emits their results on the
+// calling thread in order. At most window tasks are started beyond
+// the last emitted one, which bounds the buffered output. A task that
+// is started when all previous ones are emitted is flagged as direct,
+// i.e. it may write directly to stdout.
+class Ordered_Pool {
+    public:
+        Ordered_Pool(size_t k, unsigned n, size_t window);
+        void run(const function<void(size_t, bool, Worker&)> &process,
+                const function<void(size_t)> &emit);
+    private:
+        void work(const function<void(size_t, bool, Worker&)> &process);
+
+        size_t                k_ {0};
+        unsigned              n_ {1};
+        size_t                window_ {1};
+        mutex                 m_;
+        condition_variable    cv_;
+        vector<char>          done_;
+        vector<exception_ptr> errors_;
+        size_t                next_ {0};
+        size_t                emitted_ {0};
+        bool                  stop_ {false};
+};
+Ordered_Pool::Ordered_Pool(size_t k, unsigned n, size_t window)
+    :
+        k_(k),
+        n_(n),
+        window_(window),
+        done_(k),
+        errors_(k)
+{
+}
+void Ordered_Pool::work(const function<void(size_t, bool, Worker&)> &process)
+{
+    Worker w;
+    for (;;) {
+        size_t i = 0;
+        bool direct = false;
+        {
+            unique_lock<mutex> lock(m_);
+            cv_.wait(lock, [this]() { return stop_ || next_ >= k_
+                    || next_ < emitted_ + window_; });
+            if (stop_ || next_ >= k_)
+                return;
+            i = next_++;
+            direct = i == emitted_;
+        }
+        try {
+            process(i, direct, w);
+        } catch (...) {
+            errors_[i] = current_exception();
+        }
+        {
+            lock_guard<mutex> lock(m_);
+            done_[i] = true;
+        }
+        cv_.notify_all();
+    }
+}
+// NB: in case of an error, the partial result is emitted before the
+// error is rethrown, as in the sequential case
+void Ordered_Pool::run(const function<void(size_t, bool, Worker&)> &process,
+        const function<void(size_t)> &emit)
+{
+    vector<thread> workers;
+    for (unsigned i = 0; i < n_; ++i)
+        workers.emplace_back([this, &process]() { work(process); });
+    try {
+        for (size_t i = 0; i < k_; ++i) {
+            {
+                unique_lock<mutex> lock(m_);
+                cv_.wait(lock, [this, i]() { return bool(done_[i]); });
+            }
+            emit(i);
+            if (errors_[i])
+                rethrow_exception(errors_[i]);
+            {
+                lock_guard<mutex> lock(m_);
+                ++emitted_;
+            }
+            cv_.notify_all();
+        }
+    } catch (...) {
+        {
+            lock_guard<mutex> lock(m_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto &w : workers)
+            w.join();
+        throw;
+    }
+    for (auto &w : workers)
+        w.join();
+}
+
+// one file of a concurrent dcat
+struct Job {
+    const char            *filename {nullptr};
+    Magic                  magic {Magic::NONE};
+    // i.e. uncompressed files are passed through when it's their turn
+    ixxx::util::FD         fd;
+    vector<unsigned char>  head;
+    unique_ptr<Spool>      spool;
+};
+
+static void process_file(Job &job, bool direct, bool mixed, Worker &w)
+{
+    ixxx::util::FD fd(job.filename, O_RDONLY | O_CLOEXEC);
+    size_t n = ixxx::util::read_all(fd, w.buf.data(), max_magic_size);
+    job.magic = detect_file(job.filename, w.buf.data(), w.buf.data() + n);
+    if (job.magic == Magic::NONE && !mixed) {
+        job.head.assign(w.buf.data(), w.buf.data() + n);
+        job.fd = std::move(fd);
+        return;
+    }
+    if (!direct)
+        job.spool.reset(new Spool());
+    if (job.magic == Magic::NONE || w.decoders.get(job.magic)) {
+        w.out.redirect(job.spool.get());
+        try {
+            decode_file(w.decoders, fd, w.buf, n, w.out, mixed, job.magic);
+        } catch (const exception &e) {
+            w.out.flush();
+            throw runtime_error(string(job.filename) + ": " + e.what());
+        }
+        w.out.flush();
+        return;
+    }
+    // i.e. posix_spawn() instead of fork() since this process is threaded
+    ixxx::posix::lseek(fd, 0, SEEK_SET);
+    posix_spawn_file_actions_t as;
+    ixxx::posix::spawn_file_actions_init(&as);
+    unique_ptr<posix_spawn_file_actions_t,
+        void(*)(posix_spawn_file_actions_t *)> asp(&as,
+                ixxx::posix::spawn_file_actions_destroy);
+    ixxx::posix::spawn_file_actions_adddup2(&as, fd, 0);
+    if (!direct)
+        ixxx::posix::spawn_file_actions_adddup2(&as, job.spool->file(), 1);
+    auto v = helper_argv(job.magic);
+    pid_t pid = 0;
+    ixxx::posix::spawnp(&pid, v[0], &as, nullptr, v.data(), environ);
+    wait_cat(pid, job.filename);
+}
+
+// Decompresses up to n files concurrently into spools and writes
+// them out in the order of the arguments, i.e. the output is the same
+// as the one of the sequential cat_files().
+static void cat_files_parallel(const deque<const char*> &filenames, unsigned n,
+        bool mixed)
+{
+    vector<Job> jobs(filenames.size());
+    for (size_t i = 0; i < filenames.size(); ++i)
+        jobs[i].filename = filenames[i];
+    vector<unsigned char> buf(buffer_size);
+    Ordered_Pool pool(jobs.size(), n, n);
+    pool.run(
+            [&jobs, mixed](size_t i, bool direct, Worker &w) {
+                process_file(jobs[i], direct, mixed, w);
+            },
+            [&jobs, &buf](size_t i) {
+                auto &job = jobs[i];
+                if (job.fd.get() != -1) {
+                    ixxx::util::write_all(1, job.head.data(), job.head.size());
+                    passthrough(job.fd, 1, buf);
+                    job.fd.close();
+                } else if (job.spool) {
+                    job.spool->emit(1, buf);
+                    job.spool.reset();
                 }
+            });
+}
+
+// a part of a compressed file that can be decoded independently,
+// i.e. a zstd frame, a BGZF block or an xz block
+struct Frame {
+    size_t off   {0};
+    size_t size  {0};
+    int    check {0};  // i.e. lzma_check of xz blocks
+};
+
+#ifdef HAVE_ZSTD
+static bool index_zstd(const unsigned char *p, size_t n, vector<Frame> &frames)
+{
+    for (size_t off = 0; off < n; ) {
+        size_t k = ZSTD_findFrameCompressedSize(p + off, n - off);
+        if (ZSTD_isError(k))
+            return false;
+        frames.push_back(Frame { off, k });
+        off += k;
+    }
+    return true;
+}
+#endif
+
+#ifdef HAVE_ZLIB
+// i.e. each gzip member contains its size in the BC extra subfield,
+// cf. section 4.1 of the SAM specification
+static bool index_bgzf(const unsigned char *p, size_t n, vector<Frame> &frames)
+{
+    for (size_t off = 0; off < n; ) {
+        const unsigned char *q = p + off;
+        if (n - off < 18 || q[0] != 0x1f || q[1] != 0x8b || q[2] != 8
+                || !(q[3] & 4))
+            return false;
+        size_t xlen = q[10] | q[11] << 8;
+        if (n - off < 12 + xlen)
+            return false;
+        size_t bsize = 0;
+        for (size_t i = 12; i + 4 <= 12 + xlen; ) {
+            size_t slen = q[i + 2] | q[i + 3] << 8;
+            if (q[i] == 'B' && q[i + 1] == 'C' && slen == 2 && i + 6 <= 12 + xlen) {
+                bsize = (q[i + 4] | q[i + 5] << 8) + 1;
+                break;
+            }
+            i += 4 + slen;
+        }
+        if (!bsize || bsize > n - off)
+            return false;
+        frames.push_back(Frame { off, bsize });
+        off += bsize;
+    }
+    return true;
+}
+#endif
+
+#ifdef HAVE_LZMA
+// i.e. reads the index of each stream, starting from the end,
+// as xz --list does
+static bool index_xz(const unsigned char *p, size_t n, vector<Frame> &frames)
+{
+    const size_t hs = LZMA_STREAM_HEADER_SIZE;
+    deque<Frame> r;
+    for (size_t pos = n; pos; ) {
+        // i.e. stream padding
+        while (pos >= 4 && !p[pos - 1] && !p[pos - 2] && !p[pos - 3] && !p[pos - 4])
+            pos -= 4;
+        if (!pos)
+            break;
+        if (pos < 2 * hs)
+            return false;
+        lzma_stream_flags footer;
+        if (lzma_stream_footer_decode(&footer, p + pos - hs) != LZMA_OK
+                || footer.backward_size > pos - 2 * hs)
+            return false;
+        lzma_index *idx = nullptr;
+        uint64_t memlimit = UINT64_MAX;
+        size_t in_pos = 0;
+        if (lzma_index_buffer_decode(&idx, &memlimit, nullptr,
+                    p + pos - hs - footer.backward_size, &in_pos,
+                    footer.backward_size) != LZMA_OK)
+            return false;
+        unique_ptr<lzma_index, void(*)(lzma_index*)> idxp(idx,
+                [](lzma_index *x) { lzma_index_end(x, nullptr); });
+        lzma_vli stream_size = lzma_index_stream_size(idx);
+        if (stream_size > pos)
+            return false;
+        size_t start = pos - stream_size;
+        lzma_stream_flags header;
+        if (lzma_stream_header_decode(&header, p + start) != LZMA_OK
+                || lzma_stream_flags_compare(&header, &footer) != LZMA_OK)
+            return false;
+        lzma_index_iter it;
+        lzma_index_iter_init(&it, idx);
+        vector<Frame> blocks;
+        while (!lzma_index_iter_next(&it, LZMA_INDEX_ITER_BLOCK))
+            blocks.push_back(Frame { start + size_t(it.block.compressed_file_offset),
+                    size_t(it.block.total_size), int(header.check) });
+        r.insert(r.begin(), blocks.begin(), blocks.end());
+        pos = start;
+    }
+    frames.assign(r.begin(), r.end());
+    return true;
+}
+
+static void decode_xz_block(const unsigned char *p, size_t n, lzma_check check,
+        Output &out)
+{
+    lzma_filter filters[LZMA_FILTERS_MAX + 1];
+    lzma_block block {};
+    block.version = 0;
+    block.check = check;
+    block.filters = filters;
+    block.header_size = lzma_block_header_size_decode(p[0]);
+    if (block.header_size > n || lzma_block_header_decode(&block, nullptr, p) != LZMA_OK)
+        throw runtime_error("xz: invalid block header");
+    lzma_stream s = LZMA_STREAM_INIT;
+    lzma_ret r = lzma_block_decoder(&s, &block);
+    // i.e. the options are only needed to initialize the decoder
+    for (size_t i = 0; filters[i].id != LZMA_VLI_UNKNOWN; ++i)
+        free(filters[i].options);
+    unique_ptr<lzma_stream, void(*)(lzma_stream*)> sp(&s, lzma_end);
+    if (r != LZMA_OK)
+        throw runtime_error("xz: lzma_block_decoder failed (" + to_string(r) + ")");
+    s.next_in = p + block.header_size;
+    s.avail_in = n - block.header_size;
+    for (;;) {
+        s.next_out = out.ptr();
+        s.avail_out = out.avail();
+        r = lzma_code(&s, LZMA_RUN);
+        out.commit(out.avail() - s.avail_out);
+        if (r == LZMA_STREAM_END)
+            break;
+        if (r != LZMA_OK)
+            throw runtime_error("xz: lzma_code failed (" + to_string(r) + ")");
+    }
+}
+#endif
+
+// i.e. returns false if the file doesn't consist of multiple
+// independent frames
+static bool index_frames(Magic magic, [[maybe_unused]] const unsigned char *p,
+        [[maybe_unused]] size_t n, vector<Frame> &frames)
+{
+    bool r = false;
+    switch (magic) {
+#ifdef HAVE_ZSTD
+        case Magic::ZSTANDARD: r = index_zstd(p, n, frames); break;
+#endif
+#ifdef HAVE_ZLIB
+        case Magic::GZIP:      r = index_bgzf(p, n, frames); break;
+#endif
+#ifdef HAVE_LZMA
+        case Magic::XZ:        r = index_xz(p, n, frames); break;
+#endif
+        default:
+            ;
+    }
+    return r && frames.size() > 1;
+}
+
+static void decode_frame(Magic magic, const unsigned char *p, const Frame &f,
+        Worker &w)
+{
+#ifdef HAVE_LZMA
+    if (magic == Magic::XZ) {
+        decode_xz_block(p + f.off, f.size, lzma_check(f.check), w.out);
+        return;
+    }
+#endif
+    Decoder *d = w.decoders.get(magic);
+    bool end = false;
+    for (size_t off = 0; off < f.size && !end; )
+        off += d->decode(p + f.off + off, f.size - off, w.out, end);
+    if (!end)
+        throw runtime_error("unexpected end of compressed frame");
+}
+
+// Decodes the independent frames of one file concurrently and writes
+// them out in order. Returns false if the file can't be split into
+// frames, i.e. then it has to be decoded as a stream.
+static bool cat_frames(const char *filename, unsigned n)
+{
+    // i.e. with --exec, the helper decodes the file as a whole
+    if (!use_linked_in)
+        return false;
+    ixxx::util::FD fd(filename, O_RDONLY);
+    struct stat st;
+    ixxx::posix::fstat(fd, &st);
+    if (!S_ISREG(st.st_mode))
+        return false;
+    Mapped_File f(fd);
+    const unsigned char *p = f.data();
+    Magic magic = detect_cat(p, p + min(f.size(), size_t(8)));
+    vector<Frame> frames;
+    if (!index_frames(magic, p, f.size(), frames))
+        return false;
+
+    vector<unique_ptr<Spool>> spools(frames.size());
+    vector<unsigned char> buf(buffer_size);
+    // i.e. frames are usually smaller than files
+    Ordered_Pool pool(frames.size(), n, 4 * n);
+    pool.run(
+            [&](size_t i, bool direct, Worker &w) {
+                if (!direct)
+                    spools[i].reset(new Spool());
+                w.out.redirect(spools[i].get());
+                try {
+                    decode_frame(magic, p, frames[i], w);
+                } catch (const exception &e) {
+                    w.out.flush();
+                    throw runtime_error(string(filename) + ": " + e.what());
+                }
+                w.out.flush();
+            },
+            [&spools, &buf](size_t i) {
+                if (spools[i]) {
+                    spools[i]->emit(1, buf);
+                    spools[i].reset();
+                }
+            });
+    return true;
+}
+
+// A position where decoding can start: either at the start of a stream
+// (i.e. a zstd frame or a gzip member) or inside a deflate stream, which
+// then also requires the preceding 32 KiB of output (the window) and the
+// bits of the byte before coff that belong to the next block.
+struct Checkpoint {
+    uint64_t uoff  {0};  // i.e. the uncompressed offset
+    uint64_t coff  {0};
+    uint64_t woff  {0};  // i.e. where the window is stored in the index file
+    uint32_t wsize {0};  // i.e. 0 at the start of a stream
+    uint32_t bits  {0};
+};
+
+// i.e. the uncompressed distance between two checkpoints
+static const uint64_t index_span = 4 * 1024 * 1024;
+
+// The index file (FILE.dcx) layout, all numbers are 64 bit little endian:
+//
+//     magic, file size, file mtime (ns), uncompressed size, n, table offset
+//     windows...
+//     n * (uoff, coff, woff, wsize, bits)
+//
+// The file size and mtime detect a stale index.
+static const char index_magic[8] = { 'D', 'C', 'A', 'T', 'I', 'D', 'X', '1' };
+
+static string index_name(const char *filename)
+{
+    return string(filename) + ".dcx";
+}
+
+static uint64_t mtime_ns(const struct stat &st)
+{
+    return uint64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// Writes the index into a temporary file that replaces the
+// index file on commit.
+class Index_Writer {
+    public:
+        Index_Writer(const char *filename);
+        void add(Checkpoint c, const vector<unsigned char> &window = {});
+        void commit(const struct stat &st, uint64_t total);
+    private:
+        void write(const vector<uint64_t> &v);
+
+        string             name_;
+        string             tmp_;
+        ixxx::util::FD     fd_;
+        uint64_t           off_ {0};
+        vector<Checkpoint> cps_;
+};
+Index_Writer::Index_Writer(const char *filename)
+    :
+        name_(index_name(filename)),
+        tmp_(name_ + ".tmp"),
+        fd_(tmp_, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0666)
+{
+    // i.e. the header is written on commit
+    off_ = 6 * sizeof(uint64_t);
+    ixxx::posix::lseek(fd_, off_, SEEK_SET);
+}
+void Index_Writer::write(const vector<uint64_t> &v)
+{
+    vector<uint64_t> w(v.size());
+    transform(v.begin(), v.end(), w.begin(), [](uint64_t x) { return htole64(x); });
+    ixxx::util::write_all(fd_, w.data(), w.size() * sizeof(uint64_t));
+    off_ += w.size() * sizeof(uint64_t);
+}
+void Index_Writer::add(Checkpoint c, const vector<unsigned char> &window)
+{
+    if (!window.empty()) {
+        c.woff = off_;
+        c.wsize = window.size();
+        ixxx::util::write_all(fd_, window);
+        off_ += window.size();
+    }
+    cps_.push_back(c);
+}
+void Index_Writer::commit(const struct stat &st, uint64_t total)
+{
+    uint64_t table = off_;
+    for (auto &c : cps_)
+        write({ c.uoff, c.coff, c.woff, c.wsize, c.bits });
+    ixxx::posix::lseek(fd_, 0, SEEK_SET);
+    ixxx::util::write_all(fd_, index_magic, sizeof index_magic);
+    write({ uint64_t(st.st_size), mtime_ns(st), total, cps_.size(), table });
+    fd_.close();
+    ixxx::posix::rename(tmp_, name_);
+}
+
+// Returns false if there is no index file or if it's stale.
+static bool read_index(const char *filename, const struct stat &st,
+        ixxx::util::FD &fd, vector<Checkpoint> &cps)
+{
+    string name(index_name(filename));
+    int x = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (x == -1) {
+        if (errno == ENOENT)
+            return false;
+        throw system_error(errno, generic_category(), "opening " + name);
+    }
+    fd = ixxx::util::FD(x);
+    char magic[sizeof index_magic];
+    uint64_t h[5];
+    if (ixxx::util::read_all(fd, magic, sizeof magic) != sizeof magic
+            || memcmp(magic, index_magic, sizeof magic)
+            || ixxx::util::read_all(fd, h, sizeof h) != sizeof h)
+        throw runtime_error(name + ": not an index file");
+    for (auto &x : h)
+        x = le64toh(x);
+    if (h[0] != uint64_t(st.st_size) || h[1] != mtime_ns(st)) {
+        cerr << "Warning: ignoring stale index " << name << '\n';
+        return false;
+    }
+    vector<uint64_t> v(h[3] * 5);
+    ixxx::posix::lseek(fd, h[4], SEEK_SET);
+    if (ixxx::util::read_all(fd, v.data(), v.size() * sizeof(uint64_t))
+            != v.size() * sizeof(uint64_t))
+        throw runtime_error(name + ": truncated index file");
+    cps.resize(h[3]);
+    for (size_t i = 0; i < cps.size(); ++i) {
+        auto p = v.data() + i * 5;
+        cps[i] = Checkpoint { le64toh(p[0]), le64toh(p[1]), le64toh(p[2]),
+            uint32_t(le64toh(p[3])), uint32_t(le64toh(p[4])) };
+    }
+    return true;
+}
+
+#ifdef HAVE_ZSTD
+// i.e. the seek table of the zstd seekable format, which is
+// stored in a skippable frame at the end of the file
+static bool zstd_seek_table(const unsigned char *p, size_t n,
+        vector<Checkpoint> &cps, uint64_t &total)
+{
+    if (n < 17 || le32(p + n - 4) != 0x8f92eab1)
+        return false;
+    size_t k = le32(p + n - 9);
+    size_t w = p[n - 5] & 0x80 ? 12 : 8;
+    if (k > (n - 17) / w)
+        return false;
+    const unsigned char *q = p + n - 9 - k * w;
+    if (le32(q - 8) != 0x184d2a5e)
+        return false;
+    uint64_t coff = 0;
+    total = 0;
+    for (size_t i = 0; i < k; ++i, q += w) {
+        if (cps.empty() || total - cps.back().uoff >= index_span)
+            cps.push_back(Checkpoint { total, coff });
+        coff += le32(q);
+        total += le32(q + 4);
+    }
+    return true;
+}
+
+// i.e. decodes the frame if the header doesn't contain the size
+static uint64_t zstd_frame_size(const unsigned char *p, size_t n)
+{
+    unsigned long long k = ZSTD_getFrameContentSize(p, n);
+    if (k != ZSTD_CONTENTSIZE_UNKNOWN && k != ZSTD_CONTENTSIZE_ERROR)
+        return k;
+    unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> ctx(ZSTD_createDCtx(),
+            ZSTD_freeDCtx);
+    vector<unsigned char> buf(buffer_size);
+    ZSTD_inBuffer in { p, n, 0 };
+    uint64_t r = 0;
+    for (;;) {
+        ZSTD_outBuffer out { buf.data(), buf.size(), 0 };
+        size_t x = ZSTD_decompressStream(ctx.get(), &out, &in);
+        if (ZSTD_isError(x))
+            throw runtime_error(string("zstd: ") + ZSTD_getErrorName(x));
+        r += out.pos;
+        if (!x)
+            break;
+        if (in.pos == in.size && out.pos < out.size)
+            throw runtime_error("unexpected end of compressed frame");
+    }
+    return r;
+}
+#endif
+
+// Computes the checkpoints of the frames (zstd) or blocks (BGZF) of a
+// file. Returns false if the file doesn't consist of such frames or if
+// some frame sizes are only known after decoding (unless decoding is ok).
+static bool index_checkpoints(Magic magic,
+        [[maybe_unused]] const unsigned char *p, [[maybe_unused]] size_t n,
+        [[maybe_unused]] bool decoding, [[maybe_unused]] vector<Checkpoint> &cps,
+        uint64_t &total)
+{
+    vector<Frame> frames;
+    total = 0;
+    switch (magic) {
+#ifdef HAVE_ZSTD
+        case Magic::ZSTANDARD:
+            if (zstd_seek_table(p, n, cps, total))
+                return true;
+            if (!index_zstd(p, n, frames))
+                return false;
+            for (auto &f : frames) {
+                if (cps.empty() || total - cps.back().uoff >= index_span)
+                    cps.push_back(Checkpoint { total, f.off });
+                unsigned long long k = ZSTD_getFrameContentSize(p + f.off, f.size);
+                if (!decoding && (k == ZSTD_CONTENTSIZE_UNKNOWN
+                            || k == ZSTD_CONTENTSIZE_ERROR))
+                    return false;
+                total += zstd_frame_size(p + f.off, f.size);
             }
+            return true;
+#endif
+#ifdef HAVE_ZLIB
+        case Magic::GZIP:
+            if (!index_bgzf(p, n, frames))
+                return false;
+            for (auto &f : frames) {
+                if (cps.empty() || total - cps.back().uoff >= index_span)
+                    cps.push_back(Checkpoint { total, f.off });
+                // i.e. ISIZE
+                const unsigned char *q = p + f.off + f.size - 4;
+                total += uint32_t(q[0]) | uint32_t(q[1]) << 8
+                    | uint32_t(q[2]) << 16 | uint32_t(q[3]) << 24;
+            }
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+#ifdef HAVE_ZLIB
+static const size_t deflate_window = 32 * 1024;
+
+// i.e. records checkpoints at deflate block boundaries, as zran.c
+// from the zlib examples does
+static void index_gzip(int fd, Index_Writer &w, uint64_t &total)
+{
+    z_stream s {};
+    if (inflateInit2(&s, 15 + 16) != Z_OK)
+        throw runtime_error("inflateInit2 failed");
+    unique_ptr<z_stream, int(*)(z_stream*)> sp(&s, inflateEnd);
+    vector<unsigned char> in(buffer_size);
+    // i.e. the circular window also serves as output buffer
+    vector<unsigned char> win(deflate_window);
+    size_t wpos = 0;
+    bool wfull = false;
+    uint64_t coff = 0, uoff = 0, last = 0;
+    bool pending = false;
+    w.add(Checkpoint());
+    for (;;) {
+        if (!s.avail_in) {
+            size_t n = ixxx::posix::read(fd, in.data(), in.size());
+            if (!n)
+                break;
+            s.next_in = in.data();
+            s.avail_in = n;
+        }
+        s.next_out = win.data() + wpos;
+        s.avail_out = win.size() - wpos;
+        size_t a = s.avail_in;
+        int r = inflate(&s, Z_BLOCK);
+        coff += a - s.avail_in;
+        size_t k = win.size() - wpos - s.avail_out;
+        uoff += k;
+        wpos += k;
+        if (wpos == win.size()) {
+            wpos = 0;
+            wfull = true;
+        }
+        if (r == Z_STREAM_END) {
+            inflateReset(&s);
+            pending = false;
+            continue;
+        }
+        if (r != Z_OK && r != Z_BUF_ERROR)
+            throw runtime_error(string("gzip: ") + (s.msg ? s.msg : "inflate failed"));
+        pending = true;
+        // i.e. at a block boundary, but not after the last block
+        if ((s.data_type & 128) && !(s.data_type & 64) && uoff - last >= index_span) {
+            vector<unsigned char> v;
+            if (wfull)
+                v.assign(win.begin() + wpos, win.end());
+            v.insert(v.end(), win.begin(), win.begin() + wpos);
+            Checkpoint c;
+            c.uoff = uoff;
+            c.coff = coff;
+            c.bits = s.data_type & 7;
+            w.add(c, v);
+            last = uoff;
         }
     }
+    if (pending)
+        throw runtime_error("unexpected end of compressed input");
+    total = uoff;
 }
 
-static void cat_stdin()
+// i.e. resumes inflating a gzip member at a checkpoint inside it
+static void inflate_from(int fd, int ifd, const Checkpoint &c, Decoders &decoders,
+        vector<unsigned char> &buf, Output &out)
+{
+    z_stream s {};
+    if (inflateInit2(&s, -15) != Z_OK)
+        throw runtime_error("inflateInit2 failed");
+    unique_ptr<z_stream, int(*)(z_stream*)> sp(&s, inflateEnd);
+    vector<unsigned char> win(c.wsize);
+    ixxx::posix::lseek(ifd, c.woff, SEEK_SET);
+    if (ixxx::util::read_all(ifd, win.data(), win.size()) != win.size())
+        throw runtime_error("truncated index file");
+    ixxx::posix::lseek(fd, c.coff - (c.bits ? 1 : 0), SEEK_SET);
+    if (c.bits) {
+        unsigned char b;
+        if (ixxx::util::read_all(fd, &b, 1) != 1)
+            throw runtime_error("unexpected end of compressed input");
+        inflatePrime(&s, c.bits, b >> (8 - c.bits));
+    }
+    inflateSetDictionary(&s, win.data(), win.size());
+    size_t n = 0, off = 0;
+    for (;;) {
+        if (out.done())
+            return;
+        if (off == n) {
+            n = ixxx::posix::read(fd, buf.data(), buf.size());
+            off = 0;
+            if (!n)
+                throw runtime_error("unexpected end of compressed input");
+        }
+        s.next_in = buf.data() + off;
+        s.avail_in = n - off;
+        s.next_out = out.ptr();
+        s.avail_out = out.avail();
+        int r = inflate(&s, Z_NO_FLUSH);
+        out.commit(out.avail() - s.avail_out);
+        off = n - s.avail_in;
+        if (r == Z_STREAM_END)
+            break;
+        if (r != Z_OK && r != Z_BUF_ERROR)
+            throw runtime_error(string("gzip: ") + (s.msg ? s.msg : "inflate failed"));
+    }
+    // i.e. skip the trailer, then the following members are decoded as usual
+    n -= off;
+    memmove(buf.data(), buf.data() + off, n);
+    n += ixxx::util::read_all(fd, buf.data() + n, buf.size() - n);
+    if (n < 8)
+        throw runtime_error("unexpected end of compressed input");
+    memmove(buf.data(), buf.data() + 8, n - 8);
+    decode(decoders, Input(fd, buf, n - 8), out, false);
+}
+#endif
+
+// Writes the checkpoints of a compressed file into its index file.
+static void write_index(const char *filename)
+{
+    ixxx::util::FD fd(filename, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    ixxx::posix::fstat(fd, &st);
+    Mapped_File f(fd);
+    Magic magic = detect_cat(f.data(), f.data() + min(f.size(), size_t(8)));
+    vector<Checkpoint> cps;
+    uint64_t total = 0;
+    if (index_checkpoints(magic, f.data(), f.size(), true, cps, total)) {
+        Index_Writer w(filename);
+        for (auto &c : cps)
+            w.add(c);
+        w.commit(st, total);
+        return;
+    }
+#ifdef HAVE_ZLIB
+    if (magic == Magic::GZIP) {
+        Index_Writer w(filename);
+        try {
+            index_gzip(fd, w, total);
+        } catch (const exception &e) {
+            throw runtime_error(string(filename) + ": " + e.what());
+        }
+        w.commit(st, total);
+        return;
+    }
+#endif
+    throw runtime_error(string(filename) + ": can't index this format");
+}
+
+// Writes len uncompressed bytes starting at off. Decoding starts at the
+// closest checkpoint before off, which are read from the index file or
+// computed on the fly for zstd frames and BGZF blocks.
+static void cat_range(const char *filename, uint64_t off, uint64_t len)
+{
+    ixxx::util::FD fd(filename, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    ixxx::posix::fstat(fd, &st);
+    vector<unsigned char> buf(buffer_size);
+    size_t n = ixxx::util::read_all(fd, buf.data(), max_magic_size);
+    Magic magic = detect_file(filename, buf.data(), buf.data() + n);
+    Output out;
+    out.limit(0, len);
+    if (magic == Magic::NONE) {
+        ixxx::posix::lseek(fd, off, SEEK_SET);
+        while (!out.done()) {
+            n = ixxx::posix::read(fd, buf.data(), buf.size());
+            if (!n)
+                break;
+            out.write(buf.data(), n);
+        }
+        out.flush();
+        return;
+    }
+    Decoders decoders;
+    if (!decoders.get(magic))
+        throw runtime_error(string(filename) + ": range reads require a linked-in "
+                + magic2cat.at(magic).front() + " decoder");
+    ixxx::util::FD ifd;
+    vector<Checkpoint> cps;
+    if (!read_index(filename, st, ifd, cps)) {
+        uint64_t total = 0;
+        if (S_ISREG(st.st_mode)) {
+            Mapped_File f(fd);
+            index_checkpoints(magic, f.data(), f.size(), false, cps, total);
+        }
+    }
+    if (cps.empty())
+        cps.push_back(Checkpoint());
+    auto c = upper_bound(cps.begin(), cps.end(), off,
+            [](uint64_t x, const Checkpoint &c) { return x < c.uoff; });
+    --c;
+    out.limit(off - c->uoff, len);
+    try {
+        if (c->wsize) {
+#ifdef HAVE_ZLIB
+            inflate_from(fd, ifd, *c, decoders, buf, out);
+#endif
+        } else {
+            ixxx::posix::lseek(fd, c->coff, SEEK_SET);
+            decode(decoders, Input(fd, buf, 0), out, false, magic);
+        }
+    } catch (const exception &e) {
+        out.flush();
+        throw runtime_error(string(filename) + ": " + e.what());
+    }
+    out.flush();
+}
+
+static void cat_stdin(bool mixed)
 {
     int fd = 0;
-    vector<unsigned char> v(8);
+    vector<unsigned char> v(max_magic_size);
     ixxx::util::read_all(fd, v);
     Magic magic = detect_cat(&*v.begin(), &*v.end());
 
+    if (magic == Magic::NONE && !mixed) {
+        Output out;
+        size_t n = v.size();
+        v.resize(buffer_size);
+        cat_plain(fd, v, n, out);
+        return;
+    }
+    Decoders decoders;
+    if (magic == Magic::NONE || decoders.get(magic)) {
+        Output out;
+        size_t n = v.size();
+        v.resize(buffer_size);
+        try {
+            decode(decoders, Input(fd, v, n), out, mixed, magic);
+        } catch (...) {
+            out.flush();
+            throw;
+        }
+        out.flush();
+        return;
+    }
+
     int pipefd[2];
     ixxx::posix::pipe(pipefd);
     int pid = ixxx::posix::fork();
@@ -180,7 +2614,7 @@ static void cat_stdin()
         ixxx::util::write_all(pipefd[1], v);
 
         size_t n = v.size();
-        const size_t N = 128*1024;
+        const size_t N = buffer_size;
         v.resize(N - n);
         ixxx::util::read_all(fd, v);
         ixxx::util::write_all(pipefd[1], v);
@@ -206,17 +2640,28 @@ static void cat_stdin()
 int main(int argc, char **argv)
 {
     Args args(argc, argv);
+    if (args.output_size)
+        output_buffer_size = args.output_size;
+    use_linked_in = !args.exec;
     try {
-        if (args.filenames.size() == 1)
-            cat_file(args.filenames.front());
-        else if (args.filenames.size() > 1)
-            cat_files(args.filenames);
+        if (args.index) {
+            for (auto filename : args.filenames)
+                write_index(filename);
+        } else if (args.range)
+            cat_range(args.filenames.front(), args.range_off, args.range_len);
+        else if (args.jobs > 1 && args.filenames.size() > 1)
+            cat_files_parallel(args.filenames,
+                    min(size_t(args.jobs), args.filenames.size()), args.mixed);
+        else if (args.jobs > 1 && args.filenames.size() == 1) {
+            if (!cat_frames(args.filenames.front(), args.jobs))
+                cat_files(args.filenames, args.mixed);
+        } else if (!args.filenames.empty())
+            cat_files(args.filenames, args.mixed);
         else if (args.read_from_stdin)
-            cat_stdin();
+            cat_stdin(args.mixed);
     } catch (const exception &e) {
         cerr << "Error: " << e.what() << '\n';
         exit(1);
     }
     return 0;
 }
-
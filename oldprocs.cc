@@ -7,6 +7,7 @@
 
 #include <ixxx/util.hh>
 #include <ixxx/posix.hh>
+#include <ixxx/linux.hh>
 #include <ixxx/ansi.hh>
 #include <ixxx/sys_error.hh>
 
@@ -20,13 +21,30 @@
 #include <utility>
 #include <stdexcept>
 #include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <string_view>
+#include <exception>
+#include <system_error>
 
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>   // makedev()
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -37,8 +55,14 @@ struct Args {
     bool restart{false};
     bool print_pid{false};
     bool check_dm{true};
+    bool all_maps{false};
+    bool by_inode{false};
+    bool json{false};
+    unsigned jobs{1};
+    const char *changed_list{nullptr};
 
     set<string> display_managers;
+    unordered_set<string> changed_files;
 
     void parse(int argc, char **argv);
     void help(ostream &o, const char *argv0);
@@ -55,8 +79,41 @@ void Args::parse(int argc, char **argv)
             restart = true;
         } else if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
             verbose = true;
+        } else if (!strcmp(argv[i], "--all-maps")) {
+            all_maps = true;
+        } else if (!strcmp(argv[i], "--json")) {
+            json = true;
+        } else if (!strcmp(argv[i], "--inode")) {
+            by_inode = true;
+        } else if (!strcmp(argv[i], "--changed-files")) {
+            if (i + 1 == argc) {
+                cerr << "Argument missing for: " << argv[i] << '\n';
+                exit(1);
+            }
+            ++i;
+            changed_list = argv[i];
         } else if (!strcmp(argv[i], "--no-check-dm")) {
             check_dm = false;
+        } else if (!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+            if (i + 1 == argc) {
+                cerr << "Argument missing for: " << argv[i] << '\n';
+                exit(1);
+            }
+            ++i;
+            char *e = nullptr;
+            errno = 0;
+            unsigned long n = strtoul(argv[i], &e, 10);
+            if (errno || !isdigit((unsigned char)*argv[i]) || *e
+                    || n > UINT_MAX) {
+                cerr << "Invalid number of jobs: " << argv[i] << '\n';
+                help(cerr, argv[0]);
+                exit(1);
+            }
+            jobs = n;
+            if (!jobs)
+                jobs = thread::hardware_concurrency();
+            if (!jobs)
+                jobs = 1;
         } else {
             cerr << "Unknown argument: " << argv[1] << '\n';
             help(cerr, argv[0]);
@@ -70,7 +127,23 @@ void Args::help(ostream &o, const char *argv0)
         "oldprocs - list and/or restart processes whose executable/libraries"
         "           were updated\n\n";
     o << "optional arguments:\n"
+         "  --all-maps            also check files that aren't mapped executable,\n"
+         "                        e.g. updated data files (default: just r-xp)\n"
+         "  --changed-files FILE  just list processes that map an old version\n"
+         "                        (deleted or replaced) of one of the files listed\n"
+         "                        in FILE (one path per line, - for stdin), e.g.\n"
+         "                        the files of a package transaction\n"
          "  -h, --help            show this help message and exit\n"
+         "  --inode               detect replaced files by comparing the inode\n"
+         "                        numbers in /proc/$pid/maps with the current files\n"
+         "                        (instead of comparing ctimes; exact and needs\n"
+         "                        fewer syscalls)\n"
+         "  --json                print JSON Lines records instead of the report,\n"
+         "                        i.e. one record per outdated process (as soon as\n"
+         "                        it's found) and a summary record with the exit\n"
+         "                        status\n"
+         "  --jobs, -j N          scan processes with N threads (default: 1,\n"
+         "                        0: number of online CPUs)\n"
          "  --no-check-dm         don't care whether a service like gdm/sddm\n"
          "                        has active session (those sessions are terminated\n"
         "                         during a service restart)\n"
@@ -85,6 +158,9 @@ void Args::help(ostream &o, const char *argv0)
 
 
 static bool log_debug;
+static mutex log_mutex;
+// i.e. stderr in JSON mode, such that stdout just contains the records
+static ostream *log_out = &cout;
 
 static void debugP()
 {
@@ -92,17 +168,18 @@ static void debugP()
 template<typename Arg, typename... Args>
 static void debugP(Arg&& arg, Args&&... args)
 {
-    cout << std::forward<Arg>(arg);
+    *log_out << std::forward<Arg>(arg);
     debugP(std::forward<Args>(args)...);
 }
 template<typename... Args>
 static void debug(Args&&... args)
 {
     if (log_debug) {
-        cout << "[dbg] ";
+        lock_guard<mutex> lock(log_mutex);
+        *log_out << "[dbg] ";
         debugP(std::forward<Args>(args)...);
-        cout << '\n';
-        cout.flush();
+        *log_out << '\n';
+        log_out->flush();
     }
 }
 
@@ -129,11 +206,18 @@ static pair<time_t, uid_t> link_ctime_uid(const std::string &name)
     return make_pair(st.st_ctime, st.st_uid);
 }
 #endif
-static time_t file_ctime(const char *name)
+// the parts of a stat result that are relevant for detecting
+// updated files
+struct File_Info {
+    time_t ctime {0};
+    dev_t  dev   {0};
+    ino_t  inode {0};
+};
+static File_Info file_info(const char *name)
 {
     struct stat st;
     ixxx::posix::stat(name, &st);
-    return st.st_ctime;
+    return File_Info { st.st_ctime, st.st_dev, st.st_ino };
 }
 static uid_t file_uid(const std::string &name)
 {
@@ -142,93 +226,265 @@ static uid_t file_uid(const std::string &name)
     return st.st_uid;
 }
 
+// Memoizes the stat results of executables/libraries across all scanned
+// processes since hundreds of processes usually map the same libc etc.
+// The key identifies the mount namespace and root directory of a process
+// plus the path inside of it.
+class Stat_Cache {
+    public:
+        File_Info stat(const string &key, const char *name);
+        size_t size() const;
+    private:
+        mutable shared_mutex m_;
+        unordered_map<string, File_Info> map_;
+};
+File_Info Stat_Cache::stat(const string &key, const char *name)
+{
+    {
+        shared_lock<shared_mutex> lock(m_);
+        auto i = map_.find(key);
+        if (i != map_.end())
+            return i->second;
+    }
+    // NB: errors aren't cached, i.e. a failed stat is retried
+    auto t = file_info(name);
+    unique_lock<shared_mutex> lock(m_);
+    map_.emplace(key, t);
+    return t;
+}
+size_t Stat_Cache::size() const
+{
+    shared_lock<shared_mutex> lock(m_);
+    return map_.size();
+}
+
+// one line of /proc/$pid/maps
+struct Mapping {
+    string_view range;   // i.e. the name under /proc/$pid/map_files/
+    string_view perms;
+    dev_t       dev   {0};
+    ino_t       inode {0};
+    string_view path;    // relative to the root of the process
+};
+
+// Reads the complete maps file into a buffer that is reused for all
+// processes and tokenizes it in place. Each mapped file is returned
+// just once, even if it's mapped multiple times (as usual for shared
+// libraries).
 class Maps_Reader {
     public:
-      Maps_Reader(const string &filename, const char *exe);
-      ~Maps_Reader();
-      Maps_Reader(const Maps_Reader&) =delete;
-      Maps_Reader &operator=(const Maps_Reader&) =delete;
-      const char *next();
+      Maps_Reader(bool all_maps = false);
+      void read(const string &filename, const char *exe);
+      bool next(Mapping &m);
     private:
-      ixxx::util::File f_;
-      char *line_;
-      size_t n_;
-      const char *exe_;
+      bool seen(dev_t dev, ino_t inode);
+
+      vector<char> buf_;
+      const char *p_ {nullptr};
+      const char *end_ {nullptr};
+      string_view exe_;
+      vector<pair<dev_t, ino_t>> seen_;
+      bool all_maps_ {false};
 };
-Maps_Reader::Maps_Reader(const string &filename, const char *exe)
+Maps_Reader::Maps_Reader(bool all_maps)
     :
-        f_(filename, "r"),
-        line_(static_cast<char*>(ixxx::ansi::malloc(1024))),
-        n_(1024),
-        exe_(exe)
+        buf_(64 * 1024),
+        all_maps_(all_maps)
 {
 }
-Maps_Reader::~Maps_Reader()
+void Maps_Reader::read(const string &filename, const char *exe)
 {
-    free(line_);
+    ixxx::util::FD fd(filename, O_RDONLY);
+    size_t n = 0;
+    for (;;) {
+        if (buf_.size() - n < 4096)
+            buf_.resize(buf_.size() * 2);
+        size_t k = ixxx::util::read_retry(fd, buf_.data() + n, buf_.size() - n);
+        if (!k)
+            break;
+        n += k;
+    }
+    p_   = buf_.data();
+    end_ = p_ + n;
+    exe_ = exe;
+    seen_.clear();
 }
-const char *Maps_Reader::next()
+bool Maps_Reader::seen(dev_t dev, ino_t inode)
 {
-    for (;;) {
-        auto r = ixxx::posix::getline(&line_, &n_, f_);
-        if (r == -1)
-            return nullptr;
-        char *p = static_cast<char*>(memchr(line_, '\n', r));
-        if (!p)
-            return nullptr;
-        *p = 0;
-        --r;
-        const char xmark[] = " r-xp ";
-        char *e = static_cast<char*>(memmem(line_, r, xmark, sizeof xmark - 1));
+    // usually just a few dozen distinct files per process
+    for (auto &x : seen_)
+        if (x.first == dev && x.second == inode)
+            return true;
+    seen_.emplace_back(dev, inode);
+    return false;
+}
+static const char *next_field(const char *p, const char *e)
+{
+    p = static_cast<const char*>(memchr(p, ' ', e - p));
+    if (!p)
+        return e;
+    for (; p != e && *p == ' '; ++p)
+        ;
+    return p;
+}
+// e.g. 7f2c1d9c8000-7f2c1db3d000 r-xp 00028000 fd:01 1315165   /usr/lib64/libc.so.6
+bool Maps_Reader::next(Mapping &m)
+{
+    while (p_ != end_) {
+        const char *b = p_;
+        const char *e = static_cast<const char*>(memchr(b, '\n', end_ - b));
         if (!e)
+            e = end_;
+        p_ = e == end_ ? e : e + 1;
+
+        const char *x = next_field(b, e);
+        if (x == e)
+            continue;
+        m.range = string_view(b, x - 1 - b);
+        const char *y = next_field(x, e);
+        m.perms = string_view(x, y - x - (y != e));
+        if (!all_maps_ && m.perms != "r-xp")
+            continue;
+        x = next_field(y, e);           // skip offset
+        y = next_field(x, e);
+        if (y == e)
+            continue;
+        char *t = nullptr;
+        unsigned long major = strtoul(x, &t, 16);
+        unsigned long minor = strtoul(t + 1, nullptr, 16);
+        m.dev = makedev(major, minor);
+        m.inode = strtoul(y, &t, 10);
+        x = next_field(y, e);
+        if (x == e || *x != '/')
             continue;
-        p = static_cast<char*>(memchr(line_, '/', r));
-        if (!p)
+        m.path = string_view(x, e - x);
+        if (m.path == exe_)
             continue;
-        if (!strcmp(p, exe_))
+        if (seen(m.dev, m.inode))
             continue;
-        *e = 0;
-        return line_;
+        return true;
     }
+    return false;
 }
 
+static const char del_mark[] = " (deleted)";
 static bool is_deleted(const char *s, size_t l)
 {
-    const char del_mark[] = " (deleted)";
     if (l >= sizeof del_mark - 1) {
         if (!memcmp(s + (l - (sizeof del_mark - 1)), del_mark, sizeof del_mark - 1))
             return true;
     }
     return false;
 }
+// i.e. deleted objects that never had a name or whose removal doesn't
+// mean an update: memfd_create() files, POSIX and System V shared memory,
+// shared anonymous mappings (/dev/zero) and O_TMPFILE files (#inode)
+static bool is_anonymous(const char *s, size_t l)
+{
+    static const char *const prefixes[] = {
+        "/memfd:", "/dev/shm/", "/SYSV", "/dev/zero"
+    };
+    string_view v(s, l);
+    for (const char *p : prefixes)
+        if (v.substr(0, strlen(p)) == p)
+            return true;
+    if (is_deleted(s, l))
+        v.remove_suffix(sizeof del_mark - 1);
+    auto i = v.rfind('/');
+    if (i == v.npos || i + 2 >= v.size() || v[i + 1] != '#')
+        return false;
+    for (char c : v.substr(i + 2))
+        if (c < '0' || c > '9')
+            return false;
+    return true;
+}
+
+// Reads the list of files changed by e.g. a package transaction.
+// Since the kernel reports canonical paths in /proc/$pid/maps, paths that
+// contain symbolic links (e.g. /lib -> usr/lib) are also added in their
+// resolved form.
+static unordered_set<string> read_changed_files(const char *filename)
+{
+    ixxx::util::FD fd;
+    if (strcmp(filename, "-"))
+        fd = ixxx::util::FD(filename, O_RDONLY);
+    int in = fd.get() == -1 ? 0 : fd.get();
+    vector<char> buf(64 * 1024);
+    size_t n = 0;
+    for (;;) {
+        if (buf.size() - n < 4096)
+            buf.resize(buf.size() * 2);
+        size_t k = ixxx::util::read_retry(in, buf.data() + n, buf.size() - n);
+        if (!k)
+            break;
+        n += k;
+    }
+    unordered_set<string> files;
+    array<char, PATH_MAX> r;
+    const char *p = buf.data();
+    const char *end = p + n;
+    while (p != end) {
+        const char *e = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!e)
+            e = end;
+        if (e != p) {
+            auto i = files.emplace(p, e).first;
+            // NB: files removed by the transaction can't be resolved
+            if (realpath(i->c_str(), r.data()))
+                files.emplace(r.data());
+        }
+        p = e == end ? e : e + 1;
+    }
+    return files;
+}
 
 class Proc_Reader {
     public:
 
-        Proc_Reader();
+        Proc_Reader(Stat_Cache *cache = nullptr, bool all_maps = false,
+                bool by_inode = false, const unordered_set<string> *changed = nullptr);
         enum State { DONE, OK, EXE_DELETED, LIB_DELETED,
-            EXE_CTIME_MISMATCH, LIB_CTIME_MISMATCH };
-        State next();
+            EXE_CTIME_MISMATCH, LIB_CTIME_MISMATCH,
+            EXE_REPLACED, LIB_REPLACED,
+            EXE_CHANGED, LIB_CHANGED };
+        State check(const char *pid_str);
         pid_t pid() const;
         const char *pid_c_str() const;
         const char *exe() const;
+        const string &lib() const;
         uid_t uid() const;
     private:
+        void set_cache_key(size_t path_len, const char *root, size_t n);
+        File_Info cached_stat(const char *name);
+        State check_changed();
+        bool is_changed(const char *s, size_t l, ino_t inode);
+
         //State state_ {OK};
-        ixxx::util::Directory proc;
-        const struct dirent *d{nullptr};
+        const char *pid_str_ {nullptr};
+        Stat_Cache *cache_ {nullptr};
+        bool by_inode_ {false};
+        const unordered_set<string> *changed_ {nullptr};
+        string name_;
+        string lib_;
+        string key_;
+        size_t key_len_ {0};
         size_t root_off {0};
         array<char, 4096> a;
         array<char, 4096> b;
         string path;
         string path2;
+        Maps_Reader maps;
         mutable uid_t uid_{0};
 };
-Proc_Reader::Proc_Reader()
+Proc_Reader::Proc_Reader(Stat_Cache *cache, bool all_maps, bool by_inode,
+        const unordered_set<string> *changed)
     :
-        proc("/proc"),
+        cache_(cache),
+        by_inode_(by_inode),
+        changed_(changed),
         path("/proc/"),
-        path2("/proc/")
+        path2("/proc/"),
+        maps(all_maps)
 {
 }
 uid_t Proc_Reader::uid() const
@@ -242,102 +498,260 @@ uid_t Proc_Reader::uid() const
 }
 pid_t Proc_Reader::pid() const
 {
-    return atol(d->d_name);
+    return atol(pid_str_);
 }
 const char *Proc_Reader::pid_c_str() const
 {
-    return d->d_name;
+    return pid_str_;
 }
 const char *Proc_Reader::exe() const
 {
     return a.data() + root_off;
 }
-Proc_Reader::State Proc_Reader::next()
+// i.e. the offending library in case of a LIB_* state
+const string &Proc_Reader::lib() const
 {
-    for (;;) {
-        d = proc.read();
-        if (!d)
-            return DONE;
-        if (!is_num(d->d_name))
-            continue;
-        try {
-
-          for (unsigned k = 0; k<2; ++k) {
-          try {
-            path.resize(6);
-            path += d->d_name;
-            size_t path_len = path.size();
-
-            path += "/root";
-            auto l = ixxx::posix::readlink(path, b);
-
-            path.resize(path_len);
-            root_off = 0;
-            if (!k && !is_deleted(b.data(), l)) {
-                auto p = static_cast<const char*>(
-                        mempcpy(mempcpy(a.data(), path.data(), path.size()), "/root/", 6));
-                root_off = p - a.data();
-            }
+    return lib_;
+}
+// i.e. mount namespace + root directory, empty if not cacheable
+void Proc_Reader::set_cache_key(size_t path_len, const char *root, size_t n)
+{
+    key_.clear();
+    key_len_ = 0;
+    if (!cache_)
+        return;
+    struct stat st;
+    if (root_off) {
+        path.resize(path_len);
+        path += "/ns/mnt";
+        int r = ::stat(path.c_str(), &st);
+        path.resize(path_len);
+        if (r == -1)
+            return;
+        key_ = to_string(st.st_ino);
+        key_ += ':';
+        key_.append(root, n);
+    }
+    key_ += '\0';
+    key_len_ = key_.size();
+}
+File_Info Proc_Reader::cached_stat(const char *name)
+{
+    if (!key_len_)
+        return file_info(name);
+    key_.resize(key_len_);
+    key_ += name + root_off;
+    return cache_->stat(key_, name);
+}
+// i.e. the file is listed and the process still maps the old version of
+// it (deleted or replaced), in contrast to e.g. a just restarted service,
+// where an inode of 0 means: the one of the file the current path links to
+bool Proc_Reader::is_changed(const char *s, size_t l, ino_t inode)
+{
+    bool deleted = is_deleted(s, l);
+    if (deleted)
+        l -= sizeof del_mark - 1;
+    name_.assign(s, l);
+    if (!changed_->count(name_))
+        return false;
+    if (deleted)
+        return true;
+    struct stat st;
+    if (!inode) {
+        ixxx::posix::stat(path, &st);
+        inode = st.st_ino;
+    }
+    // e.g. the file was removed by the transaction
+    if (::stat(name_.c_str(), &st) == -1)
+        return true;
+    return st.st_ino != inode;
+}
+static ino_t mnt_ns(const char *filename)
+{
+    struct stat st;
+    ixxx::posix::stat(filename, &st);
+    return st.st_ino;
+}
+// i.e. just look up the exe and the mapped paths, files are only
+// stat'ed if they are listed
+//
+// The changed files are host paths, thus processes that run under
+// another root directory or in another mount namespace (e.g. containers)
+// are skipped.
+Proc_Reader::State Proc_Reader::check_changed()
+{
+    static const ino_t own_mnt_ns = mnt_ns("/proc/self/ns/mnt");
+    path.resize(6);
+    path += pid_str_;
+    size_t path_len = path.size();
+    root_off = 0;
+    try {
+        path += "/root";
+        auto l = ixxx::posix::readlink(path, b);
+        if (l != 1 || b[0] != '/') {
+            debug("skipping process with another root: ", path);
+            return OK;
+        }
+        path.resize(path_len);
+        path += "/ns/mnt";
+        if (mnt_ns(path.c_str()) != own_mnt_ns) {
+            debug("skipping process in another mount namespace: ", path);
+            return OK;
+        }
+        path.resize(path_len);
+        path += "/exe";
+        l = ixxx::posix::readlink(path.data(), a.data(), a.size() - 1);
+        a[l] = 0;
+        if (is_changed(a.data(), l, 0)) {
+            debug("executable changed: ", path, " -> ", a.data());
+            return EXE_CHANGED;
+        }
+    } catch (const ixxx::readlink_error &e) {
+        // e.g. EACCES or a kernel thread
+        return OK;
+    } catch (const ixxx::stat_error &e) {
+        // e.g. EACCES or the process is gone
+        return OK;
+    }
+    path.resize(path_len);
+    path += "/maps";
+    maps.read(path, exe());
+    Mapping m;
+    while (maps.next(m)) {
+        if (is_changed(m.path.data(), m.path.size(), m.inode)) {
+            debug("library changed: ", path, ' ', m.path);
+            lib_.assign(m.path.data(), m.path.size());
+            return LIB_CHANGED;
+        }
+    }
+    return OK;
+}
+Proc_Reader::State Proc_Reader::check(const char *pid_str)
+{
+    pid_str_ = pid_str;
+    uid_ = 0;
+    lib_.clear();
+    if (changed_)
+        return check_changed();
+    try {
 
-            path += "/exe";
+      for (unsigned k = 0; k<2; ++k) {
+      try {
+        path.resize(6);
+        path += pid_str_;
+        size_t path_len = path.size();
 
-            l = root_off + ixxx::posix::readlink(path.data(),
-                               a.data() + root_off, a.size() - root_off - 1);
-            a[l] = 0;
-            if (is_deleted(a.data(), l)) {
-                debug("executable is deleted: ", path, " -> ", a.data());
-                return EXE_DELETED;
-            }
+        path += "/root";
+        auto l = ixxx::posix::readlink(path, b);
+
+        path.resize(path_len);
+        root_off = 0;
+        if (!k && !is_deleted(b.data(), l)) {
+            auto p = static_cast<const char*>(
+                    mempcpy(mempcpy(a.data(), path.data(), path.size()), "/root/", 6));
+            root_off = p - a.data();
+        }
+        set_cache_key(path_len, b.data(), l);
+
+        path += "/exe";
+
+        l = root_off + ixxx::posix::readlink(path.data(),
+                           a.data() + root_off, a.size() - root_off - 1);
+        a[l] = 0;
+        bool deleted = is_deleted(a.data(), l);
+        if (deleted && !is_anonymous(a.data() + root_off, l - root_off)) {
+            debug("executable is deleted: ", path, " -> ", a.data());
+            return EXE_DELETED;
+        }
 
+        if (deleted) {
+            // e.g. executed from a memfd, nothing to compare with
+        } else if (by_inode_) {
+            // i.e. follows the link to the file the process was started from
+            struct stat st;
+            ixxx::posix::stat(path, &st);
+            auto y = cached_stat(a.data());
+            if (st.st_ino != y.inode || st.st_dev != y.dev) {
+                debug("executable replaced after process start: ", path, " -> ", a.data());
+                return EXE_REPLACED;
+            }
+        } else {
             // the uid of the /exe might be != than the actual uid
             auto x = link_ctime(path);
-            uid_ = 0;
-            auto y = file_ctime(a.data());
+            auto y = cached_stat(a.data()).ctime;
             if (x < y) {
                 debug("executable updated after process start: ", path, " -> ", a.data());
                 return EXE_CTIME_MISMATCH;
             }
+        }
 
-            path.resize(path_len);
-            path += "/maps";
-            path2.resize(6);
-            path2 += d->d_name;
-            path2 += "/map_files/";
-            size_t path2_len = path2.size();
-            memcpy(b.data(), a.data(), root_off);
-            Maps_Reader maps(path, a.data());
-            while (auto m = maps.next()) {
-                path2.resize(path2_len);
-                path2 += m;
-                l = root_off + ixxx::posix::readlink(path2.data(),
-                                    b.data() + root_off, b.size() - root_off - 1);
-                b[l] = 0;
-                if (is_deleted(b.data(), l)) {
-                    debug("library deleted: ", path, ' ', b.data());
+        path.resize(path_len);
+        path += "/maps";
+        path2.resize(6);
+        path2 += pid_str_;
+        path2 += "/map_files/";
+        size_t path2_len = path2.size();
+        memcpy(b.data(), a.data(), root_off);
+        maps.read(path, exe());
+        Mapping m;
+        while (maps.next(m)) {
+            if (by_inode_) {
+                // i.e. no readlink of map_files/ necessary
+                if (is_deleted(m.path.data(), m.path.size())) {
+                    if (is_anonymous(m.path.data(), m.path.size()))
+                        continue;
+                    debug("library deleted: ", path, ' ', m.path);
+                    lib_.assign(m.path.data(), m.path.size());
                     return LIB_DELETED;
                 }
-                auto x = link_ctime(path2);
-                auto y = file_ctime(b.data());
-                if (x < y) {
-                    debug("library updated after process start: ", path, ' ', b.data());
-                    return LIB_CTIME_MISMATCH;
+                if (root_off + m.path.size() >= b.size())
+                    continue;
+                *static_cast<char*>(mempcpy(b.data() + root_off,
+                            m.path.data(), m.path.size())) = 0;
+                // NB: the device number in maps is the one of the super block
+                // which differs from st_dev on e.g. btrfs subvolumes,
+                // thus, just the inode number is compared
+                auto y = cached_stat(b.data());
+                if (y.inode != m.inode) {
+                    debug("library replaced after process start: ", path, ' ', b.data());
+                    lib_ = b.data() + root_off;
+                    return LIB_REPLACED;
                 }
-            }
-            break;
-          } catch (const ixxx::stat_error &e) {
-            if (e.code() == ENOENT) {
-                debug("could not stat while processing: ", path);
                 continue;
             }
-          }
-          }
-
-        } catch (const ixxx::readlink_error &e) {
-            if (e.code() == EACCES)
-                continue;
+            path2.resize(path2_len);
+            path2.append(m.range.data(), m.range.size());
+            l = root_off + ixxx::posix::readlink(path2.data(),
+                                b.data() + root_off, b.size() - root_off - 1);
+            b[l] = 0;
+            if (is_deleted(b.data(), l)) {
+                if (is_anonymous(b.data() + root_off, l - root_off))
+                    continue;
+                debug("library deleted: ", path, ' ', b.data());
+                lib_ = b.data() + root_off;
+                return LIB_DELETED;
+            }
+            auto x = link_ctime(path2);
+            auto y = cached_stat(b.data()).ctime;
+            if (x < y) {
+                debug("library updated after process start: ", path, ' ', b.data());
+                lib_ = b.data() + root_off;
+                return LIB_CTIME_MISMATCH;
+            }
         }
-        return OK;
+        break;
+      } catch (const ixxx::stat_error &e) {
+        if (e.code() == ENOENT) {
+            debug("could not stat while processing: ", path);
+            continue;
+        }
+      }
+      }
+
+    } catch (const ixxx::readlink_error &e) {
+        // e.g. EACCES
     }
+    return OK;
 }
 
 enum class Service {
@@ -377,7 +791,87 @@ static bool ends_with(const char *begin, const char *end,
     return equal(end - m, end, b);
 }
 
-static pair<Service, string> get_service(const char *pid_str)
+enum class Slice {
+    UNKNOWN,
+    SYSTEM,
+    USER
+};
+
+// what the cgroup path of a process tells about it
+struct Cgroup_Info {
+    Service service {Service::UNKNOWN};
+    Slice   slice   {Slice::UNKNOWN};
+    string  unit;
+};
+
+static bool ends_with(string_view s, string_view suffix)
+{
+    return ends_with(s.data(), s.data() + s.size(),
+            suffix.data(), suffix.data() + suffix.size());
+}
+
+// e.g. 0::/system.slice/sshd.service                           (cgroup v2)
+//      1:name=systemd:/system.slice/sshd.service               (cgroup v1)
+// In hybrid mode both are present - and the systemd hierarchy is preferred.
+static string_view cgroup_path(const char *begin, const char *end)
+{
+    string_view r;
+    const char v1_mark[] = ":name=systemd:";
+    while (begin != end) {
+        const char *e = find(begin, end, '\n');
+        string_view line(begin, e - begin);
+        if (line.compare(0, 3, "0::") == 0) {
+            r = line.substr(3);
+        } else {
+            auto i = line.find(v1_mark);
+            if (i != line.npos)
+                return line.substr(i + sizeof v1_mark - 1);
+        }
+        begin = e == end ? e : e + 1;
+    }
+    return r;
+}
+
+// e.g. /user.slice/user-1000.slice/user@1000.service/app.slice/foo.service
+//      /user.slice/user-1000.slice/user@1000.service/init.scope
+//      /system.slice/docker.service/some/delegated/group
+//      /init.scope
+static Cgroup_Info classify_cgroup(string_view path)
+{
+    Cgroup_Info r;
+    if (path.compare(0, 12, "/user.slice/") == 0)
+        r.slice = Slice::USER;
+    else if (path.compare(0, 14, "/system.slice/") == 0 || path == "/init.scope")
+        r.slice = Slice::SYSTEM;
+
+    if (ends_with(path, "/init.scope")) {
+        r.service = Service::SYSTEMD;
+        return r;
+    }
+    // i.e. the unit is the component after the innermost slice
+    size_t i = path.rfind(".slice/");
+    i = i == path.npos ? 1 : i + 7;
+    if (i >= path.size())
+        return r;
+    string_view unit = path.substr(i, path.find('/', i) - i);
+    if (ends_with(unit, ".service")) {
+        r.service = Service::YES;
+        r.unit = unit;
+    }
+    return r;
+}
+
+// Memoizes the classification per cgroup path since all the processes
+// of a service usually share one cgroup.
+class Cgroup_Cache {
+    public:
+        Cgroup_Info get(const char *pid_str);
+        size_t size() const;
+    private:
+        mutable shared_mutex m_;
+        unordered_map<string, Cgroup_Info> map_;
+};
+Cgroup_Info Cgroup_Cache::get(const char *pid_str)
 {
     string filename("/proc/");
     filename += pid_str;
@@ -385,70 +879,221 @@ static pair<Service, string> get_service(const char *pid_str)
     ixxx::util::FD fd(filename, O_RDONLY);
     array<char, 8*1024> a;
     size_t n = ixxx::util::read_all(fd, a);
-    const char *begin = a.data();
-    const char *end = begin + n;
-    const char name_mark[] = "/system.slice/";
-    const char *p = search(begin, end, name_mark, name_mark + sizeof name_mark - 1);
-    if (p == end || (p > begin && *(p-1) != '\n' ) ) {
-        p = begin;
-    } else {
-        p += sizeof name_mark - 1;
+    string key(cgroup_path(a.data(), a.data() + n));
+    {
+        shared_lock<shared_mutex> lock(m_);
+        auto i = map_.find(key);
+        if (i != map_.end())
+            return i->second;
     }
-    end = find(p, end, '\n');
+    auto r = classify_cgroup(key);
+    unique_lock<shared_mutex> lock(m_);
+    map_.emplace(std::move(key), r);
+    return r;
+}
+size_t Cgroup_Cache::size() const
+{
+    shared_lock<shared_mutex> lock(m_);
+    return map_.size();
+}
 
-    const char service_mark[] = ".service";
-    if (ends_with(p, end, service_mark, service_mark + sizeof service_mark - 1)) {
-        p = static_cast<const char*>(memrchr(p-1, '/', end-(p-1)));
-        return make_pair(Service::YES, string(p+1, end));
-    }
-    const char init_mark[] = "/init.scope";
-    if (ends_with(p-1, end, init_mark, init_mark + sizeof init_mark - 1)) {
-        return make_pair(Service::SYSTEMD, string());
-    }
+extern char **environ;
 
-    return make_pair(Service::UNKNOWN, string());
+static string join(const vector<const char *> &args)
+{
+    string r;
+    for (auto i = args.begin(), e = args.end() - 1; i != e; ++i) {
+        if (i != args.begin())
+            r += ' ';
+        r += *i;
+    }
+    return r;
 }
 
-extern char **environ;
+// Executes commands concurrently and waits for all of them.
+// The children are tracked via pidfds in an epoll loop,
+// i.e. they are reaped in the order in which they terminate.
+class Spawn_Group {
+    public:
+        Spawn_Group(ostream &o);
+        void spawn(const vector<const char *> &args);
+        void wait();
+    private:
+        struct Child {
+            pid_t            pid {0};
+            ixxx::util::FD   fd;
+            string           cmd;
+        };
+        void reap(Child &c);
 
-static void execute(const vector<const char *> &args)
+        ostream        &o;
+        ixxx::util::FD efd;
+        deque<Child>   children;
+        string         error;
+};
+Spawn_Group::Spawn_Group(ostream &o)
+    :
+        o(o),
+        efd(ixxx::linux::epoll_create1(EPOLL_CLOEXEC))
+{
+}
+void Spawn_Group::spawn(const vector<const char *> &args)
 {
     assert(args.size() > 1);
     assert(args.back() == nullptr);
-    cout << "    => Executing:";
-    auto i = args.begin();
-    auto e = args.end() - 1;
-    for (; i != e; ++i) {
-        cout << ' ' << *i;
-    }
-    cout << '\n';
-    pid_t child_pid = 0;
-    ixxx::posix::spawnp(&child_pid,
+    Child c;
+    c.cmd = join(args);
+    o << "    => Executing: " << c.cmd << '\n';
+    ixxx::posix::spawnp(&c.pid,
             args.front(),
             nullptr, nullptr,
             const_cast<char* const*>(args.data()), environ);
+    // NB: the child can't be reaped in between, thus, the pid is still valid
+    int fd = syscall(SYS_pidfd_open, c.pid, 0);
+    if (fd == -1) {
+        // i.e. Linux < 5.3, where wait() falls back to reaping in order
+        if (errno != ENOSYS)
+            throw system_error(errno, generic_category(), "pidfd_open");
+    } else {
+        c.fd = ixxx::util::FD(fd);
+        struct epoll_event ev = {
+            .events = EPOLLIN,
+            .data = { .u64 = children.size() }
+        };
+        ixxx::linux::epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    children.push_back(std::move(c));
+}
+void Spawn_Group::reap(Child &c)
+{
     siginfo_t info;
-    ixxx::posix::waitid(P_PID, child_pid, &info, WEXITED);
+    ixxx::posix::waitid(P_PID, c.pid, &info, WEXITED);
+    c.pid = 0;
+    c.fd.close();
+    if (!error.empty())
+        return;
     if (info.si_code == CLD_EXITED) {
         if (info.si_status)
-            throw runtime_error("command exited with non-zero exit status");
+            error = "command exited with non-zero exit status: " + c.cmd;
     } else {
-        throw runtime_error("command terminated by a signal");
+        error = "command terminated by a signal: " + c.cmd;
+    }
+}
+void Spawn_Group::wait()
+{
+    size_t n = count_if(children.begin(), children.end(),
+            [](const Child &c) { return c.fd.get() != -1; });
+    while (n) {
+        struct epoll_event evs[16];
+        int k = ixxx::linux::epoll_wait(efd, evs, sizeof evs / sizeof evs[0], -1);
+        for (int i = 0; i < k; ++i) {
+            reap(children[evs[i].data.u64]);
+            --n;
+        }
+    }
+    for (auto &c : children)
+        if (c.pid)
+            reap(c);
+    children.clear();
+    if (!error.empty())
+        throw runtime_error(error);
+}
+
+// what a scan worker found out about an outdated process
+struct Proc_Record {
+    Proc_Reader::State state {Proc_Reader::OK};
+    pid_t              pid   {0};
+    uid_t              uid   {0};
+    string             exe;
+    Service            service {Service::UNKNOWN};
+    Slice              slice {Slice::UNKNOWN};
+    string             unit;
+    string             lib;
+};
+
+static const char *state2str(Proc_Reader::State s)
+{
+    switch (s) {
+        case Proc_Reader::EXE_DELETED:        return "exe_deleted";
+        case Proc_Reader::LIB_DELETED:        return "lib_deleted";
+        case Proc_Reader::EXE_CTIME_MISMATCH: return "exe_ctime_mismatch";
+        case Proc_Reader::LIB_CTIME_MISMATCH: return "lib_ctime_mismatch";
+        case Proc_Reader::EXE_REPLACED:       return "exe_replaced";
+        case Proc_Reader::LIB_REPLACED:       return "lib_replaced";
+        case Proc_Reader::EXE_CHANGED:        return "exe_changed";
+        case Proc_Reader::LIB_CHANGED:        return "lib_changed";
+        default:                              return "ok";
     }
 }
 
+static void json_str(ostream &o, string_view s)
+{
+    o << '"';
+    for (char c : s) {
+        switch (c) {
+            case '"':  o << "\\\""; break;
+            case '\\': o << "\\\\"; break;
+            case '\n': o << "\\n"; break;
+            case '\t': o << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char b[7];
+                    snprintf(b, sizeof b, "\\u%04x", unsigned(c));
+                    o << b;
+                } else {
+                    o << c;
+                }
+        }
+    }
+    o << '"';
+}
+
+// i.e. one JSON Lines record, flushed such that a consumer can already
+// act on it while the scan is still running, where recheck marks the
+// records of the scan after an automatic restart
+static void print_json(const Proc_Record &r, bool recheck)
+{
+    lock_guard<mutex> lock(log_mutex);
+    cout << "{\"type\":\"process\",\"pid\":" << r.pid << ",\"uid\":" << r.uid
+        << ",\"exe\":";
+    json_str(cout, r.exe);
+    cout << ",\"reason\":\"" << state2str(r.state) << "\",\"service\":";
+    switch (r.service) {
+        case Service::YES:     json_str(cout, r.unit); break;
+        case Service::SYSTEMD: cout << "\"init.scope\""; break;
+        default:               cout << "null";
+    }
+    cout << ",\"lib\":";
+    if (r.lib.empty())
+        cout << "null";
+    else
+        json_str(cout, r.lib);
+    cout << ",\"recheck\":" << (recheck ? "true" : "false") << "}\n";
+    cout.flush();
+}
+
 class Proc_Checker {
     public:
-        Proc_Checker(const Args &args);
+        Proc_Checker(const Args &args, bool recheck = false);
         int check();
         void report();
+        void print_json_summary(int rc);
     private:
+        void scan(const vector<string> &pids, atomic<size_t> &next_pid,
+                vector<Proc_Record> &records, Stat_Cache &cache,
+                Cgroup_Cache &cgroups);
+        void add(const Proc_Record &r);
         void report_system();
         void report_users();
+        void restart();
 
         const Args *args_{nullptr};
+        bool recheck_ {false};
         uid_t my_uid {0};
-        vector<const char *> cmd;
+        ostream *out {&cout};
+        // i.e. executed in two phases, each phase concurrently
+        deque<vector<const char *>> reexecs;
+        deque<vector<const char *>> restarts;
 
         set<string> services;
         map<uid_t, set<string>> user_services;
@@ -461,192 +1106,336 @@ class Proc_Checker {
         map<uid_t, map<string, deque<pid_t>>> processes;
 
 };
-Proc_Checker::Proc_Checker(const Args &args)
+// i.e. discards the human-readable report in JSON mode
+static ostream null_out(nullptr);
+
+Proc_Checker::Proc_Checker(const Args &args, bool recheck)
     :
-        args_(&args)
+        args_(&args),
+        recheck_(recheck)
 {
     my_uid = getuid();
+    if (args.json)
+        out = &null_out;
 }
 
-int Proc_Checker::check()
+static vector<string> list_pids()
 {
-    Proc_Reader reader;
-    Proc_Reader::State state;
-    while ((state = reader.next()) != Proc_Reader::DONE) {
+    vector<string> pids;
+    ixxx::util::Directory proc("/proc");
+    while (auto d = proc.read()) {
+        if (is_num(d->d_name))
+            pids.emplace_back(d->d_name);
+    }
+    return pids;
+}
+
+// executed by each worker thread, i.e. the workers fetch the next
+// unprocessed PID until all are processed
+void Proc_Checker::scan(const vector<string> &pids, atomic<size_t> &next_pid,
+        vector<Proc_Record> &records, Stat_Cache &cache,
+        Cgroup_Cache &cgroups)
+{
+    Proc_Reader reader(&cache, args_->all_maps, args_->by_inode,
+            args_->changed_list ? &args_->changed_files : nullptr);
+    for (;;) {
+        size_t i = next_pid.fetch_add(1, memory_order_relaxed);
+        if (i >= pids.size())
+            break;
+        auto state = reader.check(pids[i].c_str());
         if (state == Proc_Reader::OK)
             continue;
 
-        //cout << reader.pid() << ": " << reader.exe() << " -> restart!\n";
-        auto x = get_service(reader.pid_c_str());
-        //cout << "   => " << x.first << ' ' << x.second << '\n';
-
-        switch (x.first) {
-            case Service::YES:
-                if (x.second == "auditd.service")
-                    auditd = true;
-                else if (x.second == "dbus.service") {
-                    if (reader.uid() < 1000)
-                        dbusd = true;
+        auto &r = records[i];
+        r.state = state;
+        r.pid   = reader.pid();
+        r.uid   = reader.uid();
+        r.exe   = reader.exe();
+        auto x = cgroups.get(reader.pid_c_str());
+        r.service = x.service;
+        r.slice   = x.slice;
+        r.unit    = std::move(x.unit);
+        r.lib     = reader.lib();
+        if (args_->json)
+            print_json(r, recheck_);
+    }
+}
+
+// i.e. falls back to the uid if the cgroup isn't below
+// the system/user slice (e.g. no systemd cgroup hierarchy)
+static bool is_system(const Proc_Record &r)
+{
+    switch (r.slice) {
+        case Slice::SYSTEM: return true;
+        case Slice::USER:   return false;
+        default:            return r.uid < 1000;
+    }
+}
+
+void Proc_Checker::add(const Proc_Record &r)
+{
+    switch (r.service) {
+        case Service::YES:
+            if (r.unit == "auditd.service")
+                auditd = true;
+            else if (r.unit == "dbus.service") {
+                if (is_system(r))
+                    dbusd = true;
+                else {
+                    const char *b = r.exe.data();
+                    const char *e = b + r.exe.size();
+                    const char dbus_mark[] = "/dbus-daemon";
+                    if (ends_with(b, e, dbus_mark, dbus_mark + sizeof dbus_mark - 1))
+                        user_dbusd.insert(r.uid);
                     else {
-                        const char *b = reader.exe();
-                        const char *e = b + strlen(b);
-                        const char dbus_mark[] = "/dbus-daemon";
-                        if (ends_with(b, e, dbus_mark, dbus_mark + sizeof dbus_mark - 1))
-                            user_dbusd.insert(reader.uid());
-                        else {
-                            processes[reader.uid()][reader.exe()].push_back(reader.pid());
-                        }
-                    }
-                } else {
-                    if (reader.uid() < 1000) {
-                        services.insert(x.second);
-                    } else {
-                        user_services[reader.uid()].insert(x.second);
-                        if (x.second == "gnome-terminal-server.service")
-                            processes[reader.uid()][reader.exe()].push_back(reader.pid());
+                        processes[r.uid][r.exe].push_back(r.pid);
                     }
                 }
-                break;
-            case Service::SYSTEMD:
-                if (reader.uid() < 1000) {
-                    systemd = true;
-                    systemd_pid = reader.pid();
+            } else {
+                if (is_system(r)) {
+                    services.insert(r.unit);
                 } else {
-                    user_systemd.emplace(reader.uid(), reader.pid());
+                    user_services[r.uid].insert(r.unit);
+                    if (r.unit == "gnome-terminal-server.service")
+                        processes[r.uid][r.exe].push_back(r.pid);
                 }
-                break;
-            case Service::UNKNOWN:
-                processes[reader.uid()][reader.exe()].push_back(reader.pid());
-                break;
-            default:
-                ;
+            }
+            break;
+        case Service::SYSTEMD:
+            if (is_system(r)) {
+                systemd = true;
+                systemd_pid = r.pid;
+            } else {
+                user_systemd.emplace(r.uid, r.pid);
+            }
+            break;
+        case Service::UNKNOWN:
+            processes[r.uid][r.exe].push_back(r.pid);
+            break;
+        default:
+            ;
+    }
+}
+
+int Proc_Checker::check()
+{
+    auto pids = list_pids();
+    // one slot per PID such that the workers don't need to synchronize
+    // and the merge below sees the processes in /proc order
+    vector<Proc_Record> records(pids.size());
+    atomic<size_t> next_pid {0};
+    Stat_Cache cache;
+    Cgroup_Cache cgroups;
+
+    unsigned n = min(size_t(args_->jobs), max(pids.size(), size_t(1)));
+    if (n < 2) {
+        scan(pids, next_pid, records, cache, cgroups);
+    } else {
+        vector<thread> workers;
+        vector<exception_ptr> errors(n);
+        for (unsigned i = 0; i < n; ++i) {
+            workers.emplace_back([this, i, &pids, &next_pid, &records, &cache, &cgroups,
+                    &errors]() {
+                try {
+                    scan(pids, next_pid, records, cache, cgroups);
+                } catch (...) {
+                    errors[i] = current_exception();
+                    // i.e. let the other workers finish early
+                    next_pid = pids.size();
+                }
+            });
         }
+        for (auto &w : workers)
+            w.join();
+        for (auto &e : errors)
+            if (e)
+                rethrow_exception(e);
     }
+
+    debug("ctime cache: ", cache.size(), " distinct files");
+    debug("cgroup cache: ", cgroups.size(), " distinct cgroups");
+
+    for (auto &r : records) {
+        if (r.state == Proc_Reader::OK)
+            continue;
+        add(r);
+    }
+    int rc = 0;
     if (dbusd)
-        return 10;
-    if (!user_dbusd.empty() || !processes.empty())
-        return 11;
-    if (!services.empty() || !user_services.empty() || auditd
+        rc = 10;
+    else if (!user_dbusd.empty() || !processes.empty())
+        rc = 11;
+    else if (!services.empty() || !user_services.empty() || auditd
             || systemd || !user_systemd.empty())
-        return 15;
-    return 0;
+        rc = 15;
+    return rc;
+}
+
+// i.e. the breakdown of the exit status
+void Proc_Checker::print_json_summary(int rc)
+{
+    size_t n = 0;
+    for (auto &x : processes)
+        for (auto &y : x.second)
+            n += y.second.size();
+    lock_guard<mutex> lock(log_mutex);
+    cout << "{\"type\":\"summary\",\"rc\":" << rc
+        << ",\"reboot\":" << (dbusd ? "true" : "false")
+        << ",\"auditd\":" << (auditd ? "true" : "false")
+        << ",\"daemon_reexec\":" << (systemd ? "true" : "false")
+        << ",\"services\":[";
+    const char *sep = "";
+    for (auto &service : services) {
+        cout << sep;
+        json_str(cout, service);
+        sep = ",";
+    }
+    cout << "],\"user_services\":[";
+    sep = "";
+    for (auto &x : user_services) {
+        for (auto &service : x.second) {
+            cout << sep << "{\"uid\":" << x.first << ",\"service\":";
+            json_str(cout, service);
+            cout << '}';
+            sep = ",";
+        }
+    }
+    cout << "],\"user_daemon_reexec\":[";
+    sep = "";
+    for (auto &x : user_systemd) {
+        cout << sep << x.first;
+        sep = ",";
+    }
+    cout << "],\"user_relogin\":[";
+    sep = "";
+    for (auto uid : user_dbusd) {
+        cout << sep << uid;
+        sep = ",";
+    }
+    cout << "],\"manual_processes\":" << n << "}\n";
+    cout.flush();
 }
 void Proc_Checker::report()
 {
     report_system();
     report_users();
+    restart();
+}
+
+// The (system and user) managers are re-executed first such that
+// they already use the updated libraries when restarting the services.
+// Each phase batches the services into as few systemctl calls as
+// possible and the system and user batches run concurrently.
+void Proc_Checker::restart()
+{
+    for (auto phase : { &reexecs, &restarts }) {
+        if (phase->empty())
+            continue;
+        Spawn_Group g(*out);
+        for (auto &c : *phase)
+            g.spawn(c);
+        phase->clear();
+        g.wait();
+    }
 }
 
 void Proc_Checker::report_system()
 {
+    ostream &o = *out;
     if (dbusd) {
         // cf. https://bugs.debian.org/cgi-bin/bugreport.cgi?bug=805449
-        cout << "\nYou have to restart the system (because dbus changed).\n\n";
+        o << "\nYou have to restart the system (because dbus changed).\n\n";
     }
     if (auditd || systemd || !services.empty()) {
-        cout << "\nYou have to restart the following system services:\n\n";
+        o << "\nYou have to restart the following system services:\n\n";
     }
     if (auditd) {
         // cf. https://bugzilla.redhat.com/show_bug.cgi?id=973697
         //     https://bugzilla.redhat.com/show_bug.cgi?id=1026648
-        cout << "/usr/libexec/initscripts/legacy-actions/auditd/restart\n";
-        if (args_->restart && my_uid == 0) {
-            cmd.clear();
-            cmd.push_back("/usr/libexec/initscripts/legacy-actions/auditd/restart");
-            cmd.push_back(nullptr);
-            execute(cmd);
-        }
+        o << "/usr/libexec/initscripts/legacy-actions/auditd/restart\n";
+        if (args_->restart && my_uid == 0)
+            restarts.push_back({ "/usr/libexec/initscripts/legacy-actions/auditd/restart", nullptr });
     }
     if (systemd) {
-        cout << "systemctl daemon-reexec";
+        o << "systemctl daemon-reexec";
         if (args_->print_pid)
-            cout << "    # " << systemd_pid;
-        cout << '\n';
-        if (args_->restart && my_uid == 0) {
-            cmd.clear();
-            cmd.push_back("systemctl");
-            cmd.push_back("daemon-reexec");
-            cmd.push_back(nullptr);
-            execute(cmd);
-        }
+            o << "    # " << systemd_pid;
+        o << '\n';
+        if (args_->restart && my_uid == 0)
+            reexecs.push_back({ "systemctl", "daemon-reexec", nullptr });
     }
-    cmd.clear();
-    cmd.push_back("systemctl");
-    cmd.push_back("restart");
+    // i.e. systemd orders the restart jobs of one transaction
+    // according to the unit dependencies
+    vector<const char *> cmd = { "systemctl", "restart" };
     if (!services.empty()) {
         for (auto &service: services) {
-            cout << "systemctl restart " << service;
+            o << "systemctl restart " << service;
             if (args_->display_managers.count(service))
-                cout << "    # ATTENTION: a local user session might be terminated";
-            cout << '\n';
+                o << "    # ATTENTION: a local user session might be terminated";
+            o << '\n';
             if (args_->restart && my_uid == 0) {
                 if (args_->display_managers.count(service)) {
-                    cout << "    => NOT restarting it automatically!\n";
+                    o << "    => NOT restarting it automatically!\n";
                 } else {
-                    cmd.resize(2);
                     cmd.push_back(service.c_str());
-                    cmd.push_back(nullptr);
-                    execute(cmd);
                 }
             }
         }
     }
+    if (cmd.size() > 2) {
+        cmd.push_back(nullptr);
+        restarts.push_back(std::move(cmd));
+    }
 }
 
 void Proc_Checker::report_users()
 {
+    ostream &o = *out;
     for (auto uid : user_dbusd) {
-        cout << "\nYou have to logoff/login from/to session of user " << uid;
+        o << "\nYou have to logoff/login from/to session of user " << uid;
         if (uid == my_uid)
-            cout << " (your user!)";
-        cout << "\nbecause dbus changed.\n\n";
+            o << " (your user!)";
+        o << "\nbecause dbus changed.\n\n";
     }
     if (!user_services.empty() || !user_systemd.empty()) {
-        cout << "\nYou have to restart the following user services:\n\n";
+        o << "\nYou have to restart the following user services:\n\n";
     }
     if (!user_services.empty()) {
-        cmd.clear();
-        cmd.push_back("systemctl");
-        cmd.push_back("--user");
-        cmd.push_back("restart");
+        vector<const char *> cmd = { "systemctl", "--user", "restart" };
         for (auto &x: user_services) {
             for (auto &service: x.second) {
                 if (x.first != my_uid)
-                    cout << "sudo -u '#" << x.first << "' ";
-                cout << "systemctl --user restart " << service << '\n';
-                if (args_->restart && my_uid == x.first) {
-                    cmd.resize(3);
+                    o << "sudo -u '#" << x.first << "' ";
+                o << "systemctl --user restart " << service << '\n';
+                if (args_->restart && my_uid == x.first)
                     cmd.push_back(service.c_str());
-                    cmd.push_back(nullptr);
-                    execute(cmd);
-                }
             }
         }
+        if (cmd.size() > 3) {
+            cmd.push_back(nullptr);
+            restarts.push_back(std::move(cmd));
+        }
     }
     for (auto &x : user_systemd) {
         auto &uid = x.first; auto &pid = x.second;
         if (uid != my_uid)
-            cout << "sudo -u '#" << uid << "' ";
-        cout << "systemctl --user daemon-reexec";
+            o << "sudo -u '#" << uid << "' ";
+        o << "systemctl --user daemon-reexec";
         if (args_->print_pid)
-            cout << "    # " << pid;
-        cout << '\n';
-        if (args_->restart && my_uid == uid) {
-            cmd.resize(2);
-            cmd.push_back("daemon-reexec");
-            cmd.push_back(nullptr);
-            execute(cmd);
-        }
+            o << "    # " << pid;
+        o << '\n';
+        if (args_->restart && my_uid == uid)
+            reexecs.push_back({ "systemctl", "--user", "daemon-reexec", nullptr });
     }
     if (!processes.empty()) {
-        cout << "\nThe following user processes must be restarted manually\n(or a session logoff/login might take care of them):\n\n";
+        o << "\nThe following user processes must be restarted manually\n(or a session logoff/login might take care of them):\n\n";
         for (auto &x : processes) {
             for (auto &y : x.second) {
-                cout << y.first << " (uid " << x.first << ") - pids:";
+                o << y.first << " (uid " << x.first << ") - pids:";
                 for (auto pid : y.second) {
-                    cout << ' ' << pid;
+                    o << ' ' << pid;
                 }
-                cout << '\n';
+                o << '\n';
             }
         }
     }
@@ -800,14 +1589,21 @@ int main(int argc, char **argv)
     args.parse(argc, argv);
     if (args.check_dm)
         args.display_managers = get_display_managers();
+    if (args.changed_list)
+        args.changed_files = read_changed_files(args.changed_list);
     if (args.verbose)
         log_debug = true;;
+    if (args.json)
+        log_out = &cerr;
     Proc_Checker pc(args);
     int rc = pc.check();
     pc.report();
     if (rc == 15 && args.restart) {
-        pc = Proc_Checker(args);
+        pc = Proc_Checker(args, true);
         rc = pc.check();
     }
+    // i.e. just the final one
+    if (args.json)
+        pc.print_json_summary(rc);
     return rc;
 }
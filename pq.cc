@@ -26,9 +26,11 @@
 #include <string.h>      // strlen(), memcmp(), memchr(), ...
 #include <fcntl.h>       // O_RDONLY
 #include <unistd.h>      // getopt()
+#include <getopt.h>      // getopt_long()
 #include <sys/epoll.h>   // epoll_event
 #include <sys/signalfd.h>    // signalfd_siginfo
 #include <assert.h>
+#include <stdint.h>
 
 #include "syscalls.hh"
 
@@ -364,6 +366,67 @@ enum Show_Tasks {
     USER
 };
 
+enum class Phase {
+    TRAVERSE , // list /proc and /proc/$pid/task
+    FILTER   , // -e, -u, -k, -K
+    ROW      , // read and print all columns of a row
+    FLUSH    , // write stdout buffer
+
+    END_OF_ENUM
+};
+static const char * const phase2str[] = {
+    "traverse" , // TRAVERSE
+    "filter"   , // FILTER
+    "row"      , // ROW
+    "flush"      // FLUSH
+};
+static_assert(sizeof phase2str / sizeof phase2str[0] == static_cast<size_t>(Phase::END_OF_ENUM));
+
+// self-instrumentation, cf. --stats
+//
+// The counters are always incremented since that's cheap,
+// timings are only taken when enabled.
+struct Stats {
+    bool     enabled   {false};
+
+    size_t   opens     {0};
+    size_t   reads     {0};
+    size_t   bytes     {0};
+    size_t   readlinks {0};
+    size_t   stats     {0};
+    size_t   dirents   {0};
+
+    array<uint64_t, static_cast<size_t>(Phase::END_OF_ENUM)>  phase_ns {};
+    array<uint64_t, static_cast<size_t>(Column::END_OF_ENUM)> col_ns   {};
+    array<size_t  , static_cast<size_t>(Column::END_OF_ENUM)> col_n    {};
+};
+static Stats stats;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    ixxx::posix::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000lu + ts.tv_nsec;
+}
+
+// accumulates the runtime of f() if --stats is enabled
+template <typename F>
+static auto timed(Phase p, F f)
+{
+    if (!stats.enabled)
+        return f();
+    auto &acc = stats.phase_ns[static_cast<unsigned>(p)];
+    uint64_t a = now_ns();
+    if constexpr (is_void_v<decltype(f())>) {
+        f();
+        acc += now_ns() - a;
+    } else {
+        auto r = f();
+        acc += now_ns() - a;
+        return r;
+    }
+}
+
 static time_t get_boot_time()
 {
     array<char, 64> buf;
@@ -415,6 +478,7 @@ struct Args {
     Show_Tasks       show_tasks       {Show_Tasks::BOTH} ;
     bool             traverse_threads {false}            ;
     bool             show_header      {true}             ;
+    bool             show_stats       {false}            ;
 
     vector<Column>   columns                             ;
     vector<string>   env_vars                            ;
@@ -452,6 +516,8 @@ static void help(FILE *o, const char *argv0)
             "  -p PID..   only list the specified processes/threads\n"
             "  -t         also list threads\n"
             "  -u USER    filter by user/uid\n"
+            "  --stats    print I/O counters and timings per phase/column to stderr\n"
+            "             (after each round, just the counts of that round)\n"
             "\n"
             "2020, Georg Sauthoff <mail@gms.tf>, GPLv3+\n"
             ,
@@ -513,12 +579,18 @@ void Args::init_default_columns()
 void Args::parse(int argc, char **argv)
 {
     enum State { IN_PID_LIST, IN_COL_LIST };
-    char c = 0;
+    enum { OPT_STATS = 256 };
+    static const struct option long_opts[] = {
+        { "help" , no_argument, nullptr, 'h'       },
+        { "stats", no_argument, nullptr, OPT_STATS },
+        { nullptr, 0          , nullptr, 0         }
+    };
+    int c = 0;
     State state = IN_PID_LIST;
     // '-' prefix: no reordering of arguments, non-option arguments are
     // returned as argument to the 1 option
     // ':': preceding opting takes a mandatory argument
-    while ((c = getopt(argc, argv, "-ae:c:d:Hhi:Kkoptu:")) != -1) {
+    while ((c = getopt_long(argc, argv, "-ae:c:d:Hhi:Kkoptu:", long_opts, nullptr)) != -1) {
         switch (c) {
             case '?':
                 fprintf(stderr, "unexpected option character: %c\n", optopt);
@@ -567,6 +639,9 @@ void Args::parse(int argc, char **argv)
                 all_pids = true;
                 uid = parse_uid(optarg);
                 break;
+            case OPT_STATS:
+                show_stats = true;
+                break;
             case 1:
                 switch (state) {
                     case IN_PID_LIST:
@@ -636,6 +711,79 @@ void Args::parse(int argc, char **argv)
         init_default_columns();
 }
 
+// keys of /proc/$pid/status some columns are derived from,
+// cf. https://elixir.bootlin.com/linux/v5.8.9/source/fs/proc/array.c
+enum class Status_Key {
+    CPUS_ALLOWED_LIST ,
+    FDSIZE            ,
+    GID               ,
+    HUGETLBPAGES      ,
+    NAME              ,
+    NGID              ,
+    NVCTX             ,
+    PPID              ,
+    STATE             ,
+    THREADS           ,
+    UID               ,
+    UMASK             ,
+    VCTX              ,
+    VMRSS             ,
+    VMSIZE            ,
+
+    END_OF_ENUM
+};
+
+static constexpr string_view status_key2str[] = {
+    "Cpus_allowed_list"          , // CPUS_ALLOWED_LIST
+    "FDSize"                     , // FDSIZE
+    "Gid"                        , // GID
+    "HugetlbPages"               , // HUGETLBPAGES
+    "Name"                       , // NAME
+    "Ngid"                       , // NGID
+    "nonvoluntary_ctxt_switches" , // NVCTX
+    "PPid"                       , // PPID
+    "State"                      , // STATE
+    "Threads"                    , // THREADS
+    "Uid"                        , // UID
+    "Umask"                      , // UMASK
+    "voluntary_ctxt_switches"    , // VCTX
+    "VmRSS"                      , // VMRSS
+    "VmSize"                       // VMSIZE
+};
+static_assert(sizeof status_key2str / sizeof status_key2str[0] == static_cast<size_t>(Status_Key::END_OF_ENUM));
+
+// Perfect hash function for the above keys, i.e. each known key
+// maps to its own slot. Thus, a lookup is a hash computation plus
+// a single key comparison (to reject unknown keys).
+// Keys are at least 2 characters long.
+static constexpr unsigned status_hash(const char *s, size_t n)
+{
+    return (n + 4u * static_cast<unsigned char>(s[0])
+              + 2u * static_cast<unsigned char>(s[1])) % 32u;
+}
+
+struct Status_Slots {
+    array<unsigned char, 32> keys {};
+    bool                     perfect { true };
+};
+static constexpr Status_Slots mk_status_slots()
+{
+    Status_Slots r;
+    for (auto &x : r.keys)
+        x = static_cast<unsigned char>(Status_Key::END_OF_ENUM);
+    for (unsigned i = 0; i < static_cast<unsigned>(Status_Key::END_OF_ENUM); ++i) {
+        auto &k = status_key2str[i];
+        auto &x = r.keys[status_hash(k.data(), k.size())];
+        if (x != static_cast<unsigned char>(Status_Key::END_OF_ENUM))
+            r.perfect = false;
+        x = i;
+    }
+    return r;
+}
+static constexpr Status_Slots status_slots = mk_status_slots();
+static_assert(status_slots.perfect, "status_hash() has collisions - adjust its coefficients");
+
+
 struct Process;
 
 typedef string_view (Process::*Process_Attr)();
@@ -670,6 +818,9 @@ struct Process {
         string_view                   misc                     ;
         string_view                   io                       ;
 
+        array<string_view, static_cast<size_t>(Status_Key::END_OF_ENUM)>
+                                      status_index             ;
+
         array<char, 1024>             buffer                   ;
 
         unordered_map<size_t, string> username_cache           ;
@@ -679,6 +830,7 @@ struct Process {
         Process(const Process &) =delete;
         Process &operator=(const Process &) =delete;
 
+        void set_root(const string &root);
         void set_pid(size_t pid, size_t tid);
         const char *getenv(const string &s);
 
@@ -734,7 +886,8 @@ struct Process {
         void read_proc(const char *q, array<char, N> &src,
                 string_view &dst, bool prefix = false);
         string_view read_key_value(const string_view &status, const string_view &q);
-        string_view read_status(const string_view &q);
+        void index_status();
+        string_view read_status(Status_Key k);
         string_view read_io(const string_view &q);
         string_view read_stat(unsigned i);
         string_view read_link(const char *q);
@@ -795,6 +948,15 @@ string_view Process::column(Column c)
     return (this->*fn)();
 }
 
+// e.g. for replaying captured /proc/$pid/... files from a fixture directory
+void Process::set_root(const string &root)
+{
+    fn = root;
+    if (fn.empty() || fn.back() != '/')
+        fn.push_back('/');
+    fn_stem = fn.size();
+}
+
 void Process::set_pid(size_t pid, size_t tid)
 {
     this->pid = pid;
@@ -828,8 +990,12 @@ void Process::read_proc(const char *q, array<char, N> &src,
         src[0] = '\n';
     }
     try {
+        ++stats.opens;
         ixxx::util::FD fd(fn, O_RDONLY);
-        n += ixxx::util::read_all(fd, src.begin() + n, src.size() - n);
+        size_t k = ixxx::util::read_all(fd, src.begin() + n, src.size() - n);
+        ++stats.reads;
+        stats.bytes += k;
+        n += k;
     } catch (...) {
         src[0] = ' ';
         n = 1;
@@ -857,10 +1023,39 @@ string_view Process::read_key_value(const string_view &status, const string_view
     return string_view(&*p, e-p);
 }
 
-string_view Process::read_status(const string_view &q)
+// Tokenizes all status lines in one pass such that each later
+// status column is just a table lookup.
+void Process::index_status()
+{
+    status_index.fill(string_view());
+
+    auto p = status.begin();
+    auto e = status.end();
+    while (p != e) {
+        auto l = fast_find(p, e, '\n');
+        auto m = fast_find(p, l, ':');
+        size_t n = m - p;
+        if (m != l && n > 1) {
+            auto i = status_slots.keys[status_hash(&*p, n)];
+            if (i != static_cast<unsigned char>(Status_Key::END_OF_ENUM)
+                    && status_key2str[i] == string_view(&*p, n)) {
+                auto v = m + 1;
+                for ( ; v != l && (*v == ' ' || *v == '\t'); ++v)
+                    ;
+                status_index[i] = string_view(&*v, l - v);
+            }
+        }
+        p = l == e ? e : l + 1;
+    }
+}
+
+string_view Process::read_status(Status_Key k)
 {
-    read_proc("status", status_arr, status, true);
-    return read_key_value(status, q);
+    if (status.empty()) {
+        read_proc("status", status_arr, status);
+        index_status();
+    }
+    return status_index[static_cast<unsigned>(k)];
 }
 string_view Process::read_io(const string_view &q)
 {
@@ -928,6 +1123,7 @@ string_view Process::read_link(const char *q)
 
     size_t n = 0;
     try {
+        ++stats.readlinks;
         n = ixxx::posix::readlink(fn, buffer);
     } catch (const ixxx::readlink_error &e) {
         // ignore
@@ -1213,11 +1409,11 @@ string_view Process::user()
 
 string_view Process::comm()
 {
-    return read_status("\nName:");
+    return read_status(Status_Key::NAME);
 }
 string_view Process::state()
 {
-    auto x = read_status("\nState:");
+    auto x = read_status(Status_Key::STATE);
 
     auto a = fast_find(x.begin(), x.end(), '(');
     if (a != x.end())
@@ -1229,29 +1425,29 @@ string_view Process::state()
 }
 string_view Process::gid()
 {
-    auto x = read_status("\nGid:");
+    auto x = read_status(Status_Key::GID);
     auto c = nth_col(x, 1); // effective gid
     return c;
 }
 string_view Process::uid()
 {
-    auto x = read_status("\nUid:");
+    auto x = read_status(Status_Key::UID);
     auto c = nth_col(x, 1); // effective uid
     return c;
 }
 string_view Process::hugepages()
 {
-    auto x = read_status("\nHugetlbPages:");
+    auto x = read_status(Status_Key::HUGETLBPAGES);
     auto c = nth_col(x, 0);
     return c;
 }
 string_view Process::threads()
 {
-    return read_status("\nThreads:");
+    return read_status(Status_Key::THREADS);
 }
 string_view Process::ppid()
 {
-    return read_status("\nPPid:");
+    return read_status(Status_Key::PPID);
 }
 string_view Process::rchar()
 {
@@ -1283,23 +1479,23 @@ string_view Process::syscw()
 }
 string_view Process::affinity()
 {
-    return read_status("\nCpus_allowed_list:");
+    return read_status(Status_Key::CPUS_ALLOWED_LIST);
 }
 string_view Process::nvctx()
 {
-    return read_status("\nnonvoluntary_ctxt_switches:");
+    return read_status(Status_Key::NVCTX);
 }
 string_view Process::vctx()
 {
-    return read_status("\nvoluntary_ctxt_switches:");
+    return read_status(Status_Key::VCTX);
 }
 string_view Process::umask()
 {
-    return read_status("\nUmask:");
+    return read_status(Status_Key::UMASK);
 }
 string_view Process::rss()
 {
-    auto r = read_status("\nVmRSS:");
+    auto r = read_status(Status_Key::VMRSS);
     auto p = fast_find(r.begin(), r.end(), ' ');
 #if __cplusplus > 201703L
     return string_view(r.begin(), p);
@@ -1309,7 +1505,7 @@ string_view Process::rss()
 }
 string_view Process::vsize()
 {
-    auto r = read_status("\nVmSize:");
+    auto r = read_status(Status_Key::VMSIZE);
     auto p = fast_find(r.begin(), r.end(), ' ');
 #if __cplusplus > 201703L
     return string_view(r.begin(), p);
@@ -1319,11 +1515,11 @@ string_view Process::vsize()
 }
 string_view Process::fdsize()
 {
-    return read_status("\nFDSize:");
+    return read_status(Status_Key::FDSIZE);
 }
 string_view Process::numagid()
 {
-    return read_status("\nNgid:");
+    return read_status(Status_Key::NGID);
 }
 
 string_view Process::fds()
@@ -1333,9 +1529,11 @@ string_view Process::fds()
 
     size_t n = 0;
     try {
+        ++stats.opens;
         ixxx::util::Directory fds{fn};
         fn.resize(l);
         for (const struct dirent *d = fds.read(); d; d = fds.read()) {
+            ++stats.dirents;
             if (*d->d_name == '.' && (!d->d_name[1] || (d->d_name[1] == '.' && !d->d_name[2])))
                 continue;
             ++n;
@@ -1407,6 +1605,7 @@ size_t All_Traverser::next()
 
         if (!d)
             return 0;
+        ++stats.dirents;
 
         if (d->d_type == DT_DIR && *d->d_name >= '0' && *d->d_name <= '9') {
             size_t pid = 0;
@@ -1452,6 +1651,7 @@ Task_Traverser::Task_Traverser(size_t pid)
     s.append(buf.begin(), r.ptr);
     s.append("/task");
     try {
+        ++stats.opens;
         proc = ixxx::util::Directory(s);
     } catch (...) {
         // create empty traverser then
@@ -1463,6 +1663,7 @@ size_t Task_Traverser::next()
         auto d = proc.read();
         if (!d)
             return 0;
+        ++stats.dirents;
         if (*d->d_name < '0' || *d->d_name > '9')
             continue;
         size_t tid = 0;
@@ -1583,6 +1784,7 @@ bool UID_Filter::matches(size_t pid)
     base.append(buf.begin(), r.ptr);
     struct stat st;
     try {
+        ++stats.stats;
         ixxx::posix::stat(base, &st);
     } catch (const ixxx::stat_error &) {
         // race condition of readdir vs. process termination ...
@@ -1622,8 +1824,11 @@ bool Regex_Filter::matches(size_t pid)
     base.append("/comm");
 
     try {
+        ++stats.opens;
         ixxx::util::FD fd(base, O_RDONLY);
         size_t n = ixxx::util::read_all(fd, buf);
+        ++stats.reads;
+        stats.bytes += n;
         bool b = regex_search(buf.data(), buf.data() + n, expr);
         return b;
     } catch (const ixxx::open_error &) {
@@ -1667,6 +1872,7 @@ static void print_header(FILE *o, const Args &args)
 
 static void print_column(FILE *o, Process &p, Column c, const string &env_var, char delim)
 {
+    uint64_t t = stats.enabled ? now_ns() : 0;
     auto l = col2width[static_cast<unsigned>(c)];
     if (delim)
         l = 0;
@@ -1690,6 +1896,10 @@ static void print_column(FILE *o, Process &p, Column c, const string &env_var, c
             }
             break;
     }
+    if (stats.enabled) {
+        stats.col_ns[static_cast<unsigned>(c)] += now_ns() - t;
+        ++stats.col_n[static_cast<unsigned>(c)];
+    }
 }
 
 static void print_row(FILE *o, Process &proc, const Args &args)
@@ -1713,6 +1923,32 @@ static void print_row(FILE *o, Process &proc, const Args &args)
     fputc('\n', o);
 }
 
+// NB: test/pq_bench.cc includes this file for benchmarking the parsing
+// primitives without the live process table
+#ifndef PQ_NO_MAIN
+
+static void print_stats(FILE *o, const Args &args, unsigned round)
+{
+    fprintf(o, "[stats] round %u: opens %zu reads %zu bytes %zu readlinks %zu"
+            " stats %zu dirents %zu\n", round, stats.opens, stats.reads,
+            stats.bytes, stats.readlinks, stats.stats, stats.dirents);
+    for (unsigned i = 0; i < static_cast<unsigned>(Phase::END_OF_ENUM); ++i)
+        fprintf(o, "[stats] phase %-10s %12.3f ms\n", phase2str[i],
+                double(stats.phase_ns[i]) / 1e6);
+    vector<bool> seen(static_cast<size_t>(Column::END_OF_ENUM));
+    for (auto c : args.columns) {
+        auto i = static_cast<unsigned>(c);
+        if (seen[i])
+            continue;
+        seen[i] = true;
+        auto n = stats.col_n[i];
+        fprintf(o, "[stats] column %-10.*s %12.3f ms %10.1f ns/row\n",
+                int(col2header[i].size()), col2header[i].data(),
+                double(stats.col_ns[i]) / 1e6,
+                n ? double(stats.col_ns[i]) / double(n) : 0.0);
+    }
+    fflush(o);
+}
 
 
 static ixxx::util::FD add_signals(int efd)
@@ -1732,7 +1968,6 @@ static ixxx::util::FD add_signals(int efd)
     return sfd;
 }
 
-
 int main(int argc, char **argv)
 {
     Args args;
@@ -1775,6 +2010,8 @@ int main(int argc, char **argv)
     }
 
 
+    stats.enabled = args.show_stats;
+
     Process proc;
     proc.boot_time_s = args.boot_time_s;
     proc.clock_ticks = args.clock_ticks;
@@ -1798,33 +2035,39 @@ int main(int argc, char **argv)
         print_header(stdout, args);
 
 
-    for (;;) {
+    for (unsigned round = 1; ; ++round) {
         w.forward();
-        while (auto pid = trav->next()) {
+        while (auto pid = timed(Phase::TRAVERSE, [&]{ return trav->next(); })) {
 
-            if (!re_filter.matches(pid))
+            if (!timed(Phase::FILTER, [&]{ return re_filter.matches(pid); }))
                 continue;
-            if (!uid_filter.matches(pid))
+            if (!timed(Phase::FILTER, [&]{ return uid_filter.matches(pid); }))
                 continue;
 
             for (auto &tid_trav : tid_travs) {
-                tid_trav->set_pid(pid);
-                while (auto tid = tid_trav->next()) {
+                timed(Phase::TRAVERSE, [&]{ tid_trav->set_pid(pid); });
+                while (auto tid = timed(Phase::TRAVERSE, [&]{ return tid_trav->next(); })) {
 
                     proc.set_pid(pid, tid);
 
-                    unsigned flags = proc.flags();
+                    unsigned flags = timed(Phase::FILTER, [&]{ return proc.flags(); });
                     if (args.show_tasks == Show_Tasks::KERNEL
                             && (flags & PF_KTHREAD) == 0)
                         continue;
                     if (args.show_tasks == Show_Tasks::USER && flags & PF_KTHREAD)
                         continue;
 
-                    print_row(stdout, proc, args);
+                    timed(Phase::ROW, [&]{ print_row(stdout, proc, args); });
                 }
             }
         }
-        fflush(stdout);
+        timed(Phase::FLUSH, [&]{ fflush(stdout); });
+        if (stats.enabled) {
+            print_stats(stderr, args, round);
+            // i.e. each round reports just its own counters
+            stats = Stats();
+            stats.enabled = true;
+        }
         if (w.done())
             break;
         trav->reset();
@@ -1846,4 +2089,4 @@ int main(int argc, char **argv)
 
     return 0;
 }
-
+#endif // PQ_NO_MAIN
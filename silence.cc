@@ -10,16 +10,40 @@ static const char help_str[] =
 "\n"
 "Options:\n"
 "\n"
+"-e N        interpret other return codes besides 0 as success\n"
 "-h,--help   this screen\n"
 "-k,-K       enable/disable suicide on parent exit (default: disabled)\n"
 "            On Linux, a parent death signal is installed in the child\n"
 "            that execs COMMAND, otherwise the TERM signal handler kills\n"
 "            the child.\n"
+"-m SIZE     capture the output through pipes in memory (memfd) and only\n"
+"            spill it to temporary files once it exceeds SIZE bytes\n"
+"            (suffixes: K, M, G; Linux only, otherwise ignored)\n"
+"-i          capture stdout and stderr through pipes into one file such\n"
+"            that they are replayed in their original order (Linux only)\n"
+"-t          like -i, but prefix each replayed line with the time it was\n"
+"            read\n"
+"--tail-bytes N  only keep the last N bytes of stdout and stderr, each,\n"
+"            in memory, i.e. the output is read through pipes into ring\n"
+"            buffers, instead of temporary files (Linux only)\n"
+"--tail-lines N  like --tail-bytes, but keep the last N lines, where\n"
+"            --tail-bytes limits the size of the ring buffer\n"
+"            (default: 1M)\n"
+"--head N    also keep the first N bytes/lines (default: 0), omitted\n"
+"            output is marked in the replay\n"
+"--timeout N terminate COMMAND after N seconds (and kill it 10 seconds\n"
+"            later if it's still running), i.e. it counts as failed,\n"
+"            with exit status 124 (Linux only)\n"
+"\n"
+"With -m, -i, -t and --tail-*, the output that is still buffered in the\n"
+"pipes is read when COMMAND exits, i.e. silence doesn't wait for\n"
+"background processes that inherited the pipes (later writes of them\n"
+"fail with EPIPE).\n"
 "\n"
 "It honors the TMPDIR environment and defaults to /tmp in case\n"
 "it isn't set.\n"
 "\n"
-"This is a C++ reimplementation of chronic from moreutils\n"
+"This is a reimplementation of chronic from moreutils\n"
 "(which is a Perl script). See also the README.md for details\n"
 "on the differences.\n"
 "\n"
@@ -32,21 +56,34 @@ static const char help_str[] =
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <signal.h>
 
 #if defined(__linux__)
   #include <sys/prctl.h>
+  #include <sys/mman.h>
+  #include <sys/epoll.h>
+  #include <sys/sendfile.h>
+  #include <sys/signalfd.h>
+  #include <sys/timerfd.h>
+  #include <sys/ioctl.h>
+  #include <sched.h>
 #endif
 
 #include <ixxx/ixxx.hh>
 #include <ixxx/util.hh>
 #include <vector>
 #include <algorithm>
+#include <memory>
+#include <string>
 
 #ifndef USE_PRCTL
   #if defined(__linux__)
@@ -70,6 +107,38 @@ static const char help_str[] =
   #endif
 #endif
 
+#ifndef USE_SENDFILE
+  #if defined(__linux__)
+    #define USE_SENDFILE 1
+  #else
+    #define USE_SENDFILE 0
+  #endif
+#endif
+
+#ifndef USE_EPOLL
+  #if defined(__linux__)
+    #define USE_EPOLL 1
+  #else
+    #define USE_EPOLL 0
+  #endif
+#endif
+
+#ifndef USE_PIDFD
+  #if USE_EPOLL && defined(CLONE_PIDFD)
+    #define USE_PIDFD 1
+  #else
+    #define USE_PIDFD 0
+  #endif
+#endif
+
+#ifndef USE_MEMFD
+  #if USE_EPOLL && defined(MFD_CLOEXEC)
+    #define USE_MEMFD 1
+  #else
+    #define USE_MEMFD 0
+  #endif
+#endif
+
 using namespace ixxx;
 using namespace std;
 
@@ -82,29 +151,71 @@ struct Arguments {
   const char *tmpdir { "/tmp" };
   bool suicide { false};
   vector<int> success_codes;
+  bool in_memory { false };
+  size_t memory_size { 0 };
+  bool interleave { false };
+  bool timestamps { false };
+  size_t tail_bytes { 0 };
+  size_t tail_lines { 0 };
+  size_t head { 0 };
+  size_t timeout { 0 };
 };
 
+static size_t parse_size(const char *s)
+{
+  char *end = nullptr;
+  size_t n = ansi::strtoul(s, &end, 10);
+  switch (*end) {
+    case 'G': n *= 1024;
+    // fall through
+    case 'M': n *= 1024;
+    // fall through
+    case 'K': n *= 1024;
+  }
+  return n;
+}
+
 static char **parse_arguments(int argc, char **argv, Arguments &a)
 {
   const char *tmpdir = getenv("TMPDIR");
   if (tmpdir)
     a.tmpdir = tmpdir;
-  if (argc > 1 && !strcmp(argv[1], "--help")) {
-    help(stdout, argv[0]);
-    exit(0);
-  }
-  char c = 0;
-  const char opt_str[] = "+e:hkK";
+  enum { OPT_TAIL_BYTES = 256, OPT_TAIL_LINES, OPT_HEAD, OPT_TIMEOUT };
+  static const struct option long_options[] = {
+    { "help"      , no_argument      , 0, 'h'            },
+    { "tail-bytes", required_argument, 0, OPT_TAIL_BYTES },
+    { "tail-lines", required_argument, 0, OPT_TAIL_LINES },
+    { "head"      , required_argument, 0, OPT_HEAD       },
+    { "timeout"   , required_argument, 0, OPT_TIMEOUT    },
+    { 0, 0, 0, 0 }
+  };
+  int c = 0;
+  const char opt_str[] = "+e:hikKm:t";
   size_t success_codes_size = 0;
-  while ((c = getopt(argc, argv, opt_str)) != -1) {
+  while ((c = getopt_long(argc, argv, opt_str, long_options, 0)) != -1) {
     switch (c) {
       case '?': help(stderr, argv[0]); exit(1); break;
       case 'h': help(stdout, argv[0]); exit(0); break;
       case 'e': ++success_codes_size; break;
       case 'k': a.suicide = true ; break;
       case 'K': a.suicide = false; break;
+      case 'm': a.in_memory = USE_MEMFD; a.memory_size = parse_size(optarg); break;
+      case 'i': a.interleave = USE_EPOLL; break;
+      case 't': a.interleave = a.timestamps = USE_EPOLL; break;
+      case OPT_TAIL_BYTES: a.tail_bytes = parse_size(optarg); break;
+      case OPT_TAIL_LINES: a.tail_lines = ansi::strtoul(optarg, 0, 10); break;
+      case OPT_HEAD: a.head = parse_size(optarg); break;
+      case OPT_TIMEOUT: a.timeout = USE_EPOLL ? ansi::strtoul(optarg, 0, 10) : 0; break;
     }
   }
+  if (!USE_EPOLL)
+    a.tail_bytes = a.tail_lines = 0;
+  if (a.tail_lines && !a.tail_bytes)
+    a.tail_bytes = 1024 * 1024;
+  if (a.tail_bytes && a.interleave) {
+    fprintf(stderr, "--tail-bytes/--tail-lines can't be combined with -i/-t\n");
+    exit(1);
+  }
   if (optind == argc) {
     help(stderr, argv[0]);
     exit(1);
@@ -112,7 +223,7 @@ static char **parse_arguments(int argc, char **argv, Arguments &a)
   if (success_codes_size) {
     a.success_codes.reserve(success_codes_size);
     optind = 1;
-    while ((c = getopt(argc, argv, opt_str)) != -1) {
+    while ((c = getopt_long(argc, argv, opt_str, long_options, 0)) != -1) {
       switch (c) {
         case 'e': a.success_codes.push_back(ansi::strtol(optarg, 0, 10)); break;
       }
@@ -143,9 +254,41 @@ static int create_unlinked_temp_file(const char *tmpdir)
 #endif
 }
 
+// i.e. copies the captured output inside the kernel, if possible,
+// and falls back to copying it through a buffer for the rest
 static void dump(int fd, int d)
 {
-  posix::lseek(fd, 0, SEEK_SET);
+  off_t off = 0;
+#if USE_SENDFILE
+  off_t size = posix::lseek(fd, 0, SEEK_END);
+  struct stat st;
+  posix::fstat(d, &st);
+  enum { COPY, SPLICE, SENDFILE, NONE } mode = S_ISREG(st.st_mode) ? COPY
+    : S_ISFIFO(st.st_mode) ? SPLICE : SENDFILE;
+  while (off < size && mode != NONE) {
+    loff_t o = off;
+    ssize_t n = -1;
+    switch (mode) {
+      case COPY:     n = copy_file_range(fd, &o, d, nullptr, size - off, 0); break;
+      case SPLICE:   n = splice(fd, &o, d, nullptr, size - off, 0); break;
+      case SENDFILE: n = sendfile(d, fd, &off, size - off); break;
+      case NONE:     break;
+    }
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      // e.g. EXDEV for copy_file_range() between different filesystems
+      // or EINVAL for an O_APPEND output
+      mode = mode == SENDFILE ? NONE : SENDFILE;
+      continue;
+    }
+    if (!n)
+      break;
+    if (mode != SENDFILE)
+      off = o;
+  }
+#endif
+  posix::lseek(fd, off, SEEK_SET);
   char buffer[128 * 1024];
   for (;;) {
     ssize_t n = ixxx::util::read_retry(fd, buffer, sizeof(buffer));
@@ -155,6 +298,222 @@ static void dump(int fd, int d)
   }
 }
 
+// Keeps the first and the last bytes (or lines) of a stream in memory,
+// i.e. the tail is kept in a ring buffer of --tail-bytes.
+class Tail {
+  public:
+    Tail(const Arguments &a);
+    void write(const char *p, size_t n);
+    void dump(int d) const;
+  private:
+    size_t lines_;            // i.e. 0 means counting bytes
+    size_t head_max_;
+    size_t head_lines_ { 0 };
+    bool head_done_;
+    string head_;
+    vector<char> ring_;
+    size_t pos_ { 0 };
+    bool full_ { false };
+    uint64_t total_ { 0 };
+};
+Tail::Tail(const Arguments &a)
+  :
+    lines_(a.tail_lines),
+    head_max_(a.head),
+    head_done_(!a.head),
+    ring_(a.tail_bytes)
+{
+}
+void Tail::write(const char *p, size_t n)
+{
+  total_ += n;
+  if (!head_done_) {
+    size_t k = 0;
+    if (lines_) {
+      // i.e. the head is limited to the ring buffer size, as well
+      size_t m = min(n, ring_.size() - head_.size());
+      for (; k < m && head_lines_ < head_max_; ++k)
+        head_lines_ += p[k] == '\n';
+      head_done_ = head_lines_ == head_max_ || head_.size() + k == ring_.size();
+    } else {
+      k = min(n, head_max_ - head_.size());
+      head_done_ = head_.size() + k == head_max_;
+    }
+    head_.append(p, k);
+    p += k;
+    n -= k;
+  }
+  if (n >= ring_.size()) {
+    memcpy(ring_.data(), p + n - ring_.size(), ring_.size());
+    pos_ = 0;
+    full_ = true;
+    return;
+  }
+  size_t k = min(n, ring_.size() - pos_);
+  memcpy(ring_.data() + pos_, p, k);
+  memcpy(ring_.data(), p + k, n - k);
+  if (pos_ + n >= ring_.size())
+    full_ = true;
+  pos_ = (pos_ + n) % ring_.size();
+}
+void Tail::dump(int d) const
+{
+  string t;
+  if (full_)
+    t.append(ring_.data() + pos_, ring_.size() - pos_);
+  t.append(ring_.data(), pos_);
+  size_t off = 0;
+  if (lines_) {
+    // i.e. the last line doesn't necessarily end with a newline
+    size_t i = t.size() - (!t.empty() && t.back() == '\n');
+    size_t k = 0;
+    for (; i > 0; --i) {
+      if (t[i - 1] == '\n' && ++k == lines_)
+        break;
+    }
+    off = i;
+  }
+  util::write_all(d, head_.data(), head_.size());
+  uint64_t omitted = total_ - head_.size() - (t.size() - off);
+  if (omitted) {
+    string m = string(!head_.empty() && head_.back() != '\n' ? "\n" : "")
+      + "[silence: " + to_string(omitted) + " bytes omitted]\n";
+    util::write_all(d, m.data(), m.size());
+  }
+  util::write_all(d, t.data() + off, t.size() - off);
+}
+
+// i.e. where the stdout or stderr of the child ends up
+struct Capture {
+  int fd { -1 };     // temporary file or memfd
+  int pipe { -1 };   // read end, only in memory/interleave/tail mode
+  bool in_memory { false };
+  unique_ptr<Tail> tail;
+};
+
+// In interleave mode, each chunk read from one of the pipes is
+// prefixed with such a header.
+struct Record {
+  uint64_t time;     // i.e. CLOCK_REALTIME in nanoseconds
+  uint32_t size;
+  uint32_t fd;       // i.e. 1 or 2
+};
+
+static void write_timestamp(int d, uint64_t t)
+{
+  time_t sec = t / 1000000000;
+  struct tm tm;
+  localtime_r(&sec, &tm);
+  char s[64];
+  size_t n = strftime(s, sizeof s, "%Y-%m-%d %H:%M:%S", &tm);
+  n += snprintf(s + n, sizeof s - n, ".%06u ", unsigned(t / 1000 % 1000000));
+  util::write_all(d, s, n);
+}
+
+// i.e. writes the records to stdout/stderr in the order they were read
+static void replay(int fd, bool timestamps)
+{
+  posix::lseek(fd, 0, SEEK_SET);
+  char buffer[128 * 1024];
+  bool line_start[3] = { false, true, true };
+  for (;;) {
+    Record r;
+    if (util::read_all(fd, &r, sizeof r) != sizeof r)
+      break;
+    size_t n = util::read_all(fd, buffer, r.size);
+    if (!timestamps) {
+      util::write_all(r.fd, buffer, n);
+      continue;
+    }
+    for (const char *p = buffer, *e = buffer + n; p != e; ) {
+      if (line_start[r.fd])
+        write_timestamp(r.fd, r.time);
+      const char *q = static_cast<const char*>(memchr(p, '\n', e - p));
+      q = q ? q + 1 : e;
+      util::write_all(r.fd, p, q - p);
+      line_start[r.fd] = q[-1] == '\n';
+      p = q;
+    }
+  }
+}
+
+#if USE_MEMFD
+
+static void spill(Capture &c, const char *tmpdir)
+{
+  int fd = create_unlinked_temp_file(tmpdir);
+  dump(c.fd, fd);
+  posix::close(c.fd);
+  c.fd = fd;
+  c.in_memory = false;
+}
+
+#endif
+
+#if USE_EPOLL
+
+// Reads one chunk (of at most max bytes) of the output of the child from
+// the j-th pipe, i.e. the output is kept in memfds as long as it fits into
+// the limit and, when interleaving, both pipes are recorded into the first
+// capture. Returns the number of bytes read, i.e. 0 when the pipe is closed.
+static size_t read_output(Capture (&cs)[2], unsigned j, const Arguments &a,
+    size_t &used, size_t max = SIZE_MAX)
+{
+  char buffer[sizeof(Record) + 128 * 1024];
+  char *b = a.interleave ? buffer + sizeof(Record) : buffer;
+  Capture &c = a.interleave ? cs[0] : cs[j];
+  size_t n = util::read_retry(cs[j].pipe, b,
+      min(max, size_t(buffer + sizeof buffer - b)));
+  if (!n) {
+    posix::close(cs[j].pipe);
+    cs[j].pipe = -1;
+    return 0;
+  }
+  size_t k = n;
+  if (c.tail) {
+    c.tail->write(b, n);
+    return k;
+  }
+  if (a.interleave) {
+    struct timespec ts;
+    posix::clock_gettime(CLOCK_REALTIME, &ts);
+    Record r = { uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec,
+      uint32_t(n), j + 1 };
+    memcpy(buffer, &r, sizeof r);
+    n += sizeof r;
+  }
+#if USE_MEMFD
+  if (c.in_memory) {
+    if (used + n > a.memory_size)
+      spill(c, a.tmpdir);
+    else
+      used += n;
+  }
+#endif
+  util::write_all(c.fd, buffer, n);
+  return k;
+}
+
+// Reads the output that is buffered in the pipes when the child has
+// exited, i.e. it doesn't wait for descendants that inherited the pipes
+// and might keep them open for much longer.
+static void drain_output(Capture (&cs)[2], const Arguments &a, size_t &used)
+{
+  for (unsigned j = 0; j < 2; ++j) {
+    int n = 0;
+    if (cs[j].pipe == -1 || ioctl(cs[j].pipe, FIONREAD, &n) == -1)
+      continue;
+    for (size_t left = n; left; ) {
+      size_t k = read_output(cs, j, a, used, left);
+      if (!k)
+        break;
+      left -= k;
+    }
+  }
+}
+
+#endif
+
 #if !USE_PRCTL
 
 static pid_t child_pid_ = 0;
@@ -175,7 +534,224 @@ static bool is_successful(int code, const vector<int> &codes)
   return !code;
 }
 
-static void supervise_child(int fd_o, int fd_e, pid_t pid, const Arguments &a)
+static void finish(Capture (&cs)[2], const siginfo_t &siginfo,
+    const Arguments &a, bool timed_out)
+{
+  int code = siginfo.si_code == CLD_EXITED
+      ? siginfo.si_status : 128 + siginfo.si_status;
+  // i.e. like timeout(1), even if COMMAND exits with 0 after the TERM
+  if (timed_out)
+    code = 124;
+  if (!timed_out && is_successful(code, a.success_codes)) {
+    exit(0);
+  } else {
+    if (cs[0].tail) {
+      cs[0].tail->dump(1);
+      cs[1].tail->dump(2);
+    } else if (a.interleave) {
+      replay(cs[0].fd, a.timestamps);
+    } else {
+      dump(cs[0].fd, 1);
+      dump(cs[1].fd, 2);
+    }
+    if (timed_out)
+      fprintf(stderr, "silence: timed out after %zu s\n", a.timeout);
+    exit(code);
+  }
+}
+
+// i.e. runs in the child, which, when it's cloned, shares the memory
+// with the suspended parent until it execs COMMAND, thus it must not
+// throw or exit() but only issue system calls
+static void exec_child(int fd_o, int fd_e, char **argv)
+{
+  if (dup2(fd_o, 1) == -1 || dup2(fd_e, 2) == -1) {
+    perror("dup2");
+    _exit(126);
+  }
+  execvp(*argv, argv);
+  // i.e. perror() might change errno, e.g. when stderr is a pipe
+  int e = errno;
+  perror("executing command");
+  // cf. http://tldp.org/LDP/abs/html/exitcodes.html
+  _exit(e == ENOENT ? 127 : 126);
+}
+
+struct Child_Args {
+  int fd_o;
+  int fd_e;
+  char **argv;
+  bool suicide;
+  pid_t ppid;
+  const sigset_t *mask;
+};
+
+static int child_main(void *p)
+{
+  const Child_Args &x = *static_cast<const Child_Args*>(p);
+#if USE_PRCTL
+  if (x.suicide) {
+    if (prctl(PR_SET_PDEATHSIG, SIGTERM) == -1 || getppid() != x.ppid)
+      _exit(1);
+  }
+#endif
+  if (x.mask)
+    sigprocmask(SIG_SETMASK, x.mask, 0);
+  exec_child(x.fd_o, x.fd_e, x.argv);
+  return 1;
+}
+
+// i.e. the pidfd is -1 if it isn't supported
+struct Child {
+  pid_t pid { -1 };
+  int pidfd { -1 };
+};
+
+// Starts the child vfork-style, i.e. without copying the page tables of
+// the parent, and obtains a pidfd for it. Falls back to fork() on
+// kernels without CLONE_PIDFD (i.e. before Linux 5.2).
+static Child spawn_child(Child_Args &x)
+{
+  Child c;
+  x.ppid = getpid();
+#if USE_PIDFD
+  // i.e. execvp() only needs a few KiBs of it, the pages are only
+  // allocated when touched
+  alignas(16) static char stack[256 * 1024];
+  c.pid = clone(child_main, stack + sizeof stack,
+      CLONE_VM | CLONE_VFORK | CLONE_PIDFD | SIGCHLD, &x, &c.pidfd);
+  if (c.pid != -1)
+    return c;
+  c.pidfd = -1;
+#endif
+  c.pid = posix::fork();
+  if (!c.pid)
+    child_main(&x);
+  return c;
+}
+
+#if USE_EPOLL
+
+// Supervises the child in a single epoll loop, i.e. it waits for its
+// termination (pidfd or SIGCHLD), reads its output pipes, handles the
+// signals and enforces the timeout.
+static void supervise_child(Capture (&cs)[2], const Child &c,
+    const sigset_t &mask, const Arguments &a)
+{
+  enum { PIPE_O, PIPE_E, PIDFD, SIGNAL, TIMER };
+  util::FD efd { linux::epoll_create1(EPOLL_CLOEXEC) };
+  auto add = [&efd](int fd, uint32_t tag) {
+    struct epoll_event ev = {
+      .events = EPOLLIN,
+      .data = { .u32 = tag }
+    };
+    linux::epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev);
+  };
+  for (unsigned i = 0; i < 2; ++i) {
+    if (cs[i].pipe != -1)
+      add(cs[i].pipe, i);
+  }
+  util::FD pidfd { c.pidfd };
+  if (c.pidfd != -1)
+    add(c.pidfd, PIDFD);
+  util::FD sfd { linux::signalfd(-1, &mask, SFD_CLOEXEC) };
+  add(sfd, SIGNAL);
+  util::FD tfd;
+  if (a.timeout) {
+    tfd = util::FD(linux::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC));
+    struct itimerspec spec = { .it_value = { .tv_sec = time_t(a.timeout) } };
+    linux::timerfd_settime(tfd, 0, &spec, 0);
+    add(tfd, TIMER);
+  }
+  bool exited = false;
+  bool timed_out = false;
+  // i.e. the timer is disarmed such that it can't fire after the exit
+  auto set_exited = [&exited, &tfd]() {
+    exited = true;
+    if (tfd.get() != -1) {
+      struct itimerspec spec = {};
+      linux::timerfd_settime(tfd, 0, &spec, 0);
+    }
+  };
+  size_t used = 0;
+  while (!exited) {
+    struct epoll_event evs[5];
+    int k = 0;
+    try {
+      k = linux::epoll_wait(efd, evs, sizeof evs / sizeof evs[0], -1);
+    } catch (const ixxx::sys_error &e) {
+      // e.g. after a SIGSTOP/SIGCONT
+      if (e.code() == EINTR)
+        continue;
+      throw;
+    }
+    for (int i = 0; i < k; ++i) {
+      switch (evs[i].data.u32) {
+        case PIPE_O:
+        case PIPE_E:
+          read_output(cs, evs[i].data.u32, a, used);
+          break;
+        case PIDFD:
+          linux::epoll_ctl(efd, EPOLL_CTL_DEL, pidfd, 0);
+          set_exited();
+          break;
+        case SIGNAL: {
+          struct signalfd_siginfo info;
+          util::read_all(sfd, &info, sizeof info);
+          switch (info.ssi_signo) {
+            case SIGCHLD: {
+              // i.e. only without pidfd
+              siginfo_t si = {};
+              posix::waitid(P_PID, c.pid, &si, WEXITED | WNOHANG | WNOWAIT);
+              if (si.si_pid == c.pid)
+                set_exited();
+              break;
+            }
+            case SIGTERM: {
+              // i.e. only with -k, the child is terminated along with us
+              posix::kill(c.pid, SIGTERM);
+              sigset_t term;
+              sigemptyset(&term);
+              sigaddset(&term, SIGTERM);
+              signal(SIGTERM, SIG_DFL);
+              posix::sigprocmask(SIG_UNBLOCK, &term, 0);
+              raise(SIGTERM);
+              exit(128 + SIGTERM);
+            }
+            // else: i.e. QUIT/INT are ignored because when issued via
+            // Ctrl+\/Ctrl+C in the terminal, UNIX sends them both to the
+            // parent and the child, thus any collected output is printed
+            // after the child terminates because of those signals
+          }
+          break;
+        }
+        case TIMER: {
+          // i.e. reported along with the exit
+          if (exited)
+            break;
+          uint64_t x;
+          util::read_all(tfd, &x, sizeof x);
+          // i.e. TERM, and if that doesn't help, KILL after a grace period
+          posix::kill(c.pid, timed_out ? SIGKILL : SIGTERM);
+          if (!timed_out) {
+            struct itimerspec spec = { .it_value = { .tv_sec = 10 } };
+            linux::timerfd_settime(tfd, 0, &spec, 0);
+          }
+          timed_out = true;
+          break;
+        }
+      }
+    }
+  }
+  drain_output(cs, a, used);
+  siginfo_t siginfo;
+  posix::waitid(P_PID, c.pid, &siginfo, WEXITED);
+  finish(cs, siginfo, a, timed_out);
+}
+
+#else
+
+static void supervise_child(Capture (&cs)[2], const Child &c, const Arguments &a)
 {
   // we ignore QUIT/INT because when issued via Ctrl+\/Ctrl+C in the terminal,
   // UNIX sends them both to the parent and the child
@@ -185,72 +761,81 @@ static void supervise_child(int fd_o, int fd_e, pid_t pid, const Arguments &a)
   // because of those signals (the default action)
   struct sigaction ignore_action = {};
   ignore_action.sa_handler = SIG_IGN;
-  struct sigaction old_int_action;
-  posix::sigaction(SIGINT, &ignore_action, &old_int_action);
-  struct sigaction old_quit_action;
-  posix::sigaction(SIGQUIT, &ignore_action, &old_quit_action);
+  posix::sigaction(SIGINT, &ignore_action, 0);
+  posix::sigaction(SIGQUIT, &ignore_action, 0);
 #if !USE_PRCTL
-  child_pid_ = pid;
+  child_pid_ = c.pid;
   struct sigaction term_action = {};
   term_action.sa_handler = kill_child;
-  struct sigaction old_term_action;
   if (a.suicide)
-    posix::sigaction(SIGTERM, &term_action, &old_term_action);
+    posix::sigaction(SIGTERM, &term_action, 0);
 #endif
   siginfo_t siginfo;
-  posix:: waitid(P_PID, pid, &siginfo, WEXITED);
-#if !USE_PRCTL
-  if (a.suicide)
-    posix::sigaction(SIGTERM, &old_term_action, 0);
-#endif
-  posix::sigaction(SIGINT, &old_int_action, 0);
-  posix::sigaction(SIGQUIT, &old_quit_action, 0);
-  int code = siginfo.si_code == CLD_EXITED
-      ? siginfo.si_status : 128 + siginfo.si_status;
-  if (is_successful(code, a.success_codes)) {
-    exit(0);
-  } else {
-    dump(fd_o, 1);
-    dump(fd_e, 2);
-    exit(code);
-  }
+  posix:: waitid(P_PID, c.pid, &siginfo, WEXITED);
+  finish(cs, siginfo, a, false);
 }
 
-static void exec_child(int fd_o, int fd_e, char **argv)
-{
-  posix::dup2(fd_o, 1);
-  posix::dup2(fd_e, 2);
-  int r = execvp(*argv, argv);
-  if (r == -1) {
-    perror("executing command");
-    // cf. http://tldp.org/LDP/abs/html/exitcodes.html
-    exit(errno == ENOENT ? 127 : 126);
-  }
-}
+#endif
 
 int main(int argc, char **argv)
 {
   try {
     Arguments a;
     char **childs_argv = parse_arguments(argc, argv, a);
-    int fd_o = create_unlinked_temp_file(a.tmpdir);
-    int fd_e = create_unlinked_temp_file(a.tmpdir);
-#if USE_PRCTL
-    pid_t ppid_before_fork = getpid();
+    Capture cs[2];
+    for (unsigned i = 0; i < (a.interleave ? 1 : 2); ++i) {
+      if (a.tail_bytes) {
+        cs[i].tail = make_unique<Tail>(a);
+        continue;
+      }
+#if USE_MEMFD
+      if (a.in_memory) {
+        cs[i].fd = linux::memfd_create("silence", MFD_CLOEXEC);
+        cs[i].in_memory = true;
+        continue;
+      }
 #endif
-    pid_t pid = posix::fork();
-    if (pid) {
-      supervise_child(fd_o, fd_e, pid, a);
-    } else {
-#if USE_PRCTL
-    if (a.suicide) {
-      linux::prctl(PR_SET_PDEATHSIG, SIGTERM);
-      if (getppid() != ppid_before_fork)
-        exit(1);
+      cs[i].fd = create_unlinked_temp_file(a.tmpdir);
+    }
+    bool use_pipes = a.in_memory || a.interleave || a.tail_bytes;
+    Child_Args x = { cs[0].fd, cs[1].fd, childs_argv, a.suicide };
+    if (use_pipes) {
+      int ps[2][2];
+      for (unsigned i = 0; i < 2; ++i) {
+        posix::pipe2(ps[i], O_CLOEXEC);
+        cs[i].pipe = ps[i][0];
+      }
+      x.fd_o = ps[0][1];
+      x.fd_e = ps[1][1];
     }
+#if USE_EPOLL
+    // i.e. the signals are received through a signalfd, and the child
+    // must not run any handlers while it shares the memory
+    sigset_t mask, all, old, blocked;
+    sigfillset(&all);
+    posix::sigprocmask(SIG_BLOCK, &all, &old);
+    sigemptyset(&mask);
+    blocked = old;
+    for (int sig : { SIGCHLD, SIGINT, SIGQUIT, a.suicide ? SIGTERM : SIGCHLD }) {
+      sigaddset(&mask, sig);
+      sigaddset(&blocked, sig);
+    }
+    x.mask = &old;
+    Child c = spawn_child(x);
+    // i.e. without ever unblocking SIGCHLD
+    posix::sigprocmask(SIG_SETMASK, &blocked, 0);
+#else
+    Child c = spawn_child(x);
 #endif
-      exec_child(fd_o, fd_e, childs_argv);
+    if (use_pipes) {
+      posix::close(x.fd_o);
+      posix::close(x.fd_e);
     }
+#if USE_EPOLL
+    supervise_child(cs, c, mask, a);
+#else
+    supervise_child(cs, c, a);
+#endif
   } catch (const ixxx::sys_error &e) {
     fprintf(stderr, "%s\n", e.what());
     return 1;
@@ -61,3 +61,284 @@ def test_multiple():
         p.stdout = 'blah\n'*(1+len(cs))
 
 
+
+@pytest.mark.parametrize('c', ( 'gzip', 'bzip2', 'xz', 'lz4', 'zstd' ))
+def test_concatenated(c):
+    if c in ('zstd', 'lz4') and not shutil.which(c):
+        pytest.skip('Command {} not found in PATH'.format(c))
+    cmd = '( echo Hello | {0} -c; echo World | {0} -c ) | {1}'.format(c, dcat)
+    o = subprocess.check_output(cmd, shell=True, universal_newlines=True)
+    assert o == 'Hello\nWorld\n'
+
+@pytest.mark.parametrize('c', ( 'gzip', 'bzip2', 'xz' ))
+def test_truncated(c):
+    with tempfile.TemporaryDirectory() as d:
+        fn = '{}/txt.{}'.format(d, c)
+        b = subprocess.run([c, '-c'], input=os.urandom(64*1024),
+                stdout=subprocess.PIPE, check=True).stdout
+        with open(fn, 'wb') as f:
+            f.write(b[:len(b)//2])
+        p = subprocess.run([dcat, fn], stdout=subprocess.DEVNULL,
+                stderr=subprocess.DEVNULL)
+        assert p.returncode != 0
+
+@pytest.mark.parametrize('append', (False, True))
+def test_not_compressed_file(append):
+    b = os.urandom(1024*1024)
+    with tempfile.TemporaryDirectory() as d:
+        with open(d + '/in', 'wb') as f:
+            f.write(b)
+        with open(d + '/out', 'ab' if append else 'wb') as f:
+            subprocess.run([dcat, d + '/in', d + '/in'], stdout=f, check=True)
+        with open(d + '/out', 'rb') as f:
+            assert f.read() == b + b
+
+def test_parallel():
+    cs = [ 'gzip', 'bzip2', 'xz' ]
+    for e in ( 'lz4', 'zstd' ):
+        if shutil.which(e):
+            cs.append(e)
+    with tempfile.TemporaryDirectory() as d:
+        fns = []
+        for i in range(3):
+            for c in cs:
+                fn = '{}/{}.{}'.format(d, i, c)
+                with open(fn, 'wb') as f:
+                    subprocess.run([c, '-c'], input=os.urandom(i*100*1024 + 1).hex().encode(),
+                            stdout=f, check=True)
+                fns.append(fn)
+            fn = '{}/{}.txt'.format(d, i)
+            with open(fn, 'wb') as f:
+                f.write(os.urandom(1000).hex().encode())
+            fns.append(fn)
+        a = subprocess.run([dcat] + fns, stdout=subprocess.PIPE, check=True).stdout
+        b = subprocess.run([dcat, '-j', '4'] + fns, stdout=subprocess.PIPE, check=True).stdout
+        assert len(a) > 1024*1024
+        assert a == b
+
+def test_frames():
+    if not shutil.which('zstd'):
+        pytest.skip('Command zstd not found in PATH')
+    with tempfile.TemporaryDirectory() as d:
+        xs = [ os.urandom(300*1024 + i).hex().encode() for i in range(4) ]
+        zfn = d + '/frames.zst'
+        with open(zfn, 'wb') as f:
+            for x in xs:
+                f.write(subprocess.run(['zstd', '-c'], input=x, stdout=subprocess.PIPE,
+                    check=True).stdout)
+        xfn = d + '/blocks.xz'
+        with open(xfn, 'wb') as f:
+            subprocess.run(['xz', '-c', '--block-size=256KiB'], input=b''.join(xs),
+                    stdout=f, check=True)
+        for fn in (zfn, xfn):
+            # i.e. with --exec the helper decodes the file as a whole
+            for args in ( ['-j', '3'], ['--exec', '-j', '2'] ):
+                o = subprocess.run([dcat] + args + [fn], stdout=subprocess.PIPE,
+                        check=True).stdout
+                assert o == b''.join(xs)
+
+# i.e. a blocked gzip file as written by bgzip (cf. the SAM/BAM spec),
+# where each member stores its size in the BC extra field
+def bgzf(x, block_size=60*1024):
+    import zlib
+    r = []
+    for i in range(0, len(x), block_size):
+        b = x[i:i+block_size]
+        c = zlib.compressobj(6, zlib.DEFLATED, -15)
+        d = c.compress(b) + c.flush()
+        r.append(b'\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0'
+                + (len(d) + 25).to_bytes(2, 'little') + d
+                + zlib.crc32(b).to_bytes(4, 'little') + len(b).to_bytes(4, 'little'))
+    # i.e. the empty EOF block
+    r.append(bytes.fromhex('1f8b08040000000000ff0600424302001b0003000000000000000000'))
+    return b''.join(r)
+
+def test_bgzf_frames():
+    x = os.urandom(300*1024).hex().encode()
+    with tempfile.TemporaryDirectory() as d:
+        fn = d + '/blocks.gz'
+        with open(fn, 'wb') as f:
+            f.write(bgzf(x))
+        a = subprocess.run([dcat, fn], stdout=subprocess.PIPE, check=True).stdout
+        assert a == x
+        for args in ( ['-j', '2'], ['--exec', '-j', '2'] ):
+            o = subprocess.run([dcat] + args + [fn], stdout=subprocess.PIPE,
+                    check=True).stdout
+            assert o == a
+
+def linked_in(c):
+    o = subprocess.check_output([dcat, '--help'], universal_newlines=True)
+    return c in o.split('Linked-in decoders:')[1].split()
+
+def test_mixed_formats():
+    for c in ('gzip', 'xz', 'bzip2', 'zstd'):
+        if not linked_in(c) or not shutil.which(c):
+            pytest.skip('No linked-in {} decoder'.format(c))
+    cmd = ( '( echo Hello | gzip -c; echo World | zstd -c; echo foo | xz -c;'
+            ' echo bar | bzip2 -c; echo baz | gzip -c ) | {}' ).format(dcat)
+    o = subprocess.check_output(cmd, shell=True, universal_newlines=True)
+    assert o == 'Hello\nWorld\nfoo\nbar\nbaz\n'
+
+def test_mixed_plain():
+    for c in ('gzip', 'xz'):
+        if not linked_in(c):
+            pytest.skip('No linked-in {} decoder'.format(c))
+    x = os.urandom(100*1024).hex().encode()
+    gz = subprocess.run(['gzip', '-c'], input=x, stdout=subprocess.PIPE, check=True).stdout
+    xz = subprocess.run(['xz', '-c'], input=x, stdout=subprocess.PIPE, check=True).stdout
+    i = b'# header BZh9\n' + gz + b'# middle\n' + xz + gz + b'# trailer\n'
+    o = subprocess.run([dcat, '--mixed'], input=i, stdout=subprocess.PIPE, check=True).stdout
+    assert o == b'# header BZh9\n' + x + b'# middle\n' + x + x + b'# trailer\n'
+    o = subprocess.run([dcat], input=i, stdout=subprocess.PIPE, check=True).stdout
+    assert o == i
+
+def crc32c(b):
+    c = 0xffffffff
+    for x in b:
+        c ^= x
+        for i in range(8):
+            c = (c >> 1) ^ (0x82f63b78 & -(c & 1))
+    c ^= 0xffffffff
+    return (((c >> 15) | (c << 17)) + 0xa282ead8) & 0xffffffff
+
+def snappy_chunk(t, x, body):
+    b = crc32c(x).to_bytes(4, 'little') + body
+    return bytes([t]) + len(b).to_bytes(3, 'little') + b
+
+# i.e. one compressed chunk (a literal and an overlapping copy) and
+# one uncompressed chunk
+def snappy(x):
+    return ( b'\xff\x06\x00\x00sNaPpY'
+            + snappy_chunk(0, x * 3, bytes([len(x) * 3, (len(x) - 1) << 2]) + x
+                + bytes([((2 * len(x) - 1) << 2) | 2, len(x), 0]))
+            + snappy_chunk(1, x, x) )
+
+def lzip(x):
+    import lzma, zlib
+    b = lzma.compress(x, format=lzma.FORMAT_RAW, filters=[ { 'id': lzma.FILTER_LZMA1,
+        'dict_size': 1 << 23, 'lc': 3, 'lp': 0, 'pb': 2 } ])
+    return ( b'LZIP\x01' + bytes([23]) + b + zlib.crc32(x).to_bytes(4, 'little')
+            + len(x).to_bytes(8, 'little') + (len(b) + 26).to_bytes(8, 'little') )
+
+def streamed_zip(x, fn, zip64=False, more=()):
+    import zipfile
+    with open(fn, 'wb') as f:
+        # i.e. a non-seekable file, thus the sizes follow in a data descriptor
+        class Stream:
+            def write(self, b):
+                return f.write(b)
+            def flush(self):
+                f.flush()
+        with zipfile.ZipFile(Stream(), 'w', compression=zipfile.ZIP_DEFLATED) as z:
+            with z.open('c.txt', 'w', force_zip64=zip64) as g:
+                g.write(x)
+            for i, c in enumerate(more):
+                z.compression = c
+                with z.open('d{}.txt'.format(i), 'w') as g:
+                    g.write(x)
+
+def zip_(x, d):
+    import zipfile
+    fn = d + '/t.zip'
+    with zipfile.ZipFile(fn, 'w') as z:
+        z.writestr('a.txt', x, compress_type=zipfile.ZIP_DEFLATED)
+        z.writestr('b.txt', x, compress_type=zipfile.ZIP_STORED)
+    streamed_zip(x, d + '/s.zip')
+    with open(fn, 'rb') as f, open(d + '/s.zip', 'rb') as g:
+        return f.read() + g.read()
+
+@pytest.mark.parametrize('c', ( 'lzma', 'lzip', 'zip', 'snappy', 'brotli' ))
+def test_formats(c):
+    import lzma
+    if not linked_in(c):
+        pytest.skip('No linked-in {} decoder'.format(c))
+    x = os.urandom(64).hex().encode()
+    with tempfile.TemporaryDirectory() as d:
+        fn = '{}/txt.{}'.format(d, 'br' if c == 'brotli' else c)
+        y = x
+        if c == 'lzma':
+            i = lzma.compress(x, format=lzma.FORMAT_ALONE)
+        elif c == 'lzip':
+            i = lzip(x) + lzip(x)
+            y = x + x
+        elif c == 'zip':
+            i = zip_(x, d)
+            y = x + x
+        elif c == 'snappy':
+            y = b'Hello snappy'
+            i = snappy(y)
+            y = y * 4
+        else:
+            if not shutil.which('brotli'):
+                pytest.skip('Command brotli not found in PATH')
+            i = subprocess.run(['brotli', '-c'], input=x, stdout=subprocess.PIPE,
+                    check=True).stdout
+        with open(fn, 'wb') as f:
+            f.write(i)
+        o = subprocess.run([dcat, fn], stdout=subprocess.PIPE, check=True).stdout
+        assert o == y
+        if c != 'brotli':
+            o = subprocess.run([dcat, '--mixed'], input=b'foo\n' + i + b'bar\n',
+                    stdout=subprocess.PIPE, check=True).stdout
+            assert o == b'foo\n' + y + b'bar\n'
+        with open(fn, 'wb') as f:
+            f.write(i[:-7])
+        p = subprocess.run([dcat, fn], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        assert p.returncode != 0
+
+# i.e. the following members with a data descriptor aren't decoded,
+# even if they are unsupported, the rest of the input is ignored, instead
+def test_zip_descriptor_members():
+    import zipfile
+    if not linked_in('zip'):
+        pytest.skip('No linked-in zip decoder')
+    x = os.urandom(64).hex().encode()
+    with tempfile.TemporaryDirectory() as d:
+        fn = d + '/s.zip'
+        streamed_zip(x, fn, more=(zipfile.ZIP_BZIP2, zipfile.ZIP_DEFLATED))
+        o = subprocess.run([dcat, fn], stdout=subprocess.PIPE, check=True).stdout
+        assert o == x
+        with open(fn, 'rb') as f:
+            i = f.read()
+        o = subprocess.run([dcat], input=i + b'garbage', stdout=subprocess.PIPE,
+                check=True).stdout
+        assert o == x
+
+def test_zip64_descriptor():
+    if not linked_in('zip'):
+        pytest.skip('No linked-in zip decoder')
+    x = os.urandom(64).hex().encode()
+    with tempfile.TemporaryDirectory() as d:
+        fn = d + '/s.zip'
+        streamed_zip(x, fn, zip64=True)
+        o = subprocess.run([dcat, fn], stdout=subprocess.PIPE, check=True).stdout
+        assert o == x
+        with open(fn, 'rb') as f:
+            i = f.read()
+        o = subprocess.run([dcat], input=i + i, stdout=subprocess.PIPE,
+                check=True).stdout
+        assert o == x + x
+
+@pytest.mark.parametrize('c', ( 'gzip', 'zstd' ))
+def test_range(c):
+    if not linked_in(c) or not shutil.which(c):
+        pytest.skip('No linked-in {} decoder'.format(c))
+    x = os.urandom(6*1024*1024).hex().encode()
+    with tempfile.TemporaryDirectory() as d:
+        fn = '{}/txt.{}'.format(d, c)
+        with open(fn, 'wb') as f:
+            for i in range(0, len(x), 1024*1024):
+                subprocess.run([c, '-c'], input=x[i:i+1024*1024], stdout=f, check=True)
+        rs = ( (0, 10), (5*1024*1024 - 3, 1000), (9*1024*1024, 4*1024*1024),
+                (len(x) - 10, 100) )
+        for index in (False, True):
+            if index:
+                subprocess.run([dcat, '--index', fn], check=True)
+                assert os.path.exists(fn + '.dcx')
+            for off, n in rs:
+                o = subprocess.run([dcat, '--range', '{}:{}'.format(off, n), fn],
+                        stdout=subprocess.PIPE, check=True).stdout
+                assert o == x[off:off+n]
+        o = subprocess.run([dcat, '--range', '{}:'.format(len(x) - 5), fn],
+                stdout=subprocess.PIPE, check=True).stdout
+        assert o == x[-5:]
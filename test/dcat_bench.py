@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+#
+# dcat_bench - measure the throughput of dcat for different corpora,
+#              codecs, input/output modes and buffer sizes
+#
+# The raw results can be summarized and plotted with benchmark.py, e.g.:
+#
+#     $ ./dcat_bench.py --dcat ./dcat --size 256M --raw dcat.csv
+#     $ ../benchmark.py --input dcat.csv --cols 5 --items mb_s --graph-item mb_s
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+# SPDX-FileCopyrightText: © 2026 Georg Sauthoff <mail@gms.tf>
+
+import argparse
+import csv
+import datetime
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+codecs  = ( 'none', 'gzip', 'zstd', 'xz', 'lz4', 'bzip2' )
+corpora = ( 'random', 'text', 'repetitive' )
+# i.e. FILE argument, stdin redirected from the file, stdin from a pipe
+inputs  = ( 'file', 'stdin', 'pipe' )
+outputs = ( 'null', 'pipe' )
+# i.e. the columns of the raw CSV file, as written by benchmark.py --raw,
+# where the first four are the ones benchmark.py uses by default
+items   = ( 'wall', 'user', 'sys', 'rss', 'mb_s', 'cpu_ns_b' )
+
+def parse_size(s):
+    m = { 'K': 1024, 'M': 1024**2, 'G': 1024**3 }
+    if s[-1:].upper() in m:
+        return int(s[:-1]) * m[s[-1:].upper()]
+    return int(s)
+
+def mk_arg_parser():
+    p = argparse.ArgumentParser(description='Benchmark dcat throughput')
+    p.add_argument('--dcat', default='./dcat', help='dcat binary (default: %(default)s)')
+    p.add_argument('--size', default='256M', help='uncompressed corpus size (default: %(default)s)')
+    p.add_argument('-n', type=int, default=3, help='repetitions (default: %(default)s)')
+    p.add_argument('--corpora', nargs='+', default=corpora, choices=corpora)
+    p.add_argument('--codecs', nargs='+', default=codecs, choices=codecs,
+            help='codecs to benchmark (default: all available)')
+    p.add_argument('--inputs', nargs='+', default=inputs, choices=inputs)
+    p.add_argument('--outputs', nargs='+', default=outputs, choices=outputs)
+    p.add_argument('--buffers', nargs='+', default=['128K'],
+            help='output buffer sizes (dcat -b, default: %(default)s)')
+    p.add_argument('--exec', action='store_true',
+            help='also measure the helpers instead of the linked-in decoders')
+    p.add_argument('--raw', metavar='FILE',
+            help='write the measurements as CSV, for benchmark.py --input')
+    p.add_argument('--dir', help='work directory that keeps the corpora'
+            ' between runs (default: temporary one)')
+    return p
+
+def gen_random(f, size):
+    for i in range(0, size, 1024 * 1024):
+        f.write(os.urandom(min(1024 * 1024, size - i)))
+
+# i.e. moderately compressible, such that neither the decoder nor
+# the copying dominates
+def gen_text(f, size):
+    words = [ os.urandom(i % 7 + 2).hex() for i in range(4096) ]
+    n = 0
+    i = 0
+    while n < size:
+        line = ' '.join(words[(i * 7 + j * 13) % len(words)] for j in range(12))
+        b = (line + ' ' + os.urandom(8).hex() + '\n').encode()
+        b = b[:size - n]
+        f.write(b)
+        n += len(b)
+        i += 1
+
+def gen_repetitive(f, size):
+    b = b''.join('{:08d} the same old line\n'.format(i % 1000).encode()
+            for i in range(32 * 1024))
+    for i in range(0, size, len(b)):
+        f.write(b[:size - i])
+
+def corpus(d, name, codec, size):
+    txt = '{}/{}.txt'.format(d, name)
+    if not os.path.exists(txt) or os.path.getsize(txt) != size:
+        with open(txt, 'wb') as f:
+            globals()['gen_' + name](f, size)
+        for c in codecs[1:]:
+            fn = '{}/{}.{}'.format(d, name, c)
+            if os.path.exists(fn):
+                os.unlink(fn)
+    if codec == 'none':
+        return txt
+    fn = '{}/{}.{}'.format(d, name, codec)
+    if not os.path.exists(fn):
+        with open(txt, 'rb') as i, open(fn, 'wb') as o:
+            subprocess.run([codec, '-c'], stdin=i, stdout=o, check=True)
+    return fn
+
+# i.e. returns the rusage of dcat, excluding the helper processes
+# that feed or drain the pipes
+def measure(argv, fn, inp, out):
+    procs = []
+    stdin = None
+    f = None
+    if inp == 'stdin':
+        f = stdin = open(fn, 'rb')
+    elif inp == 'pipe':
+        c = subprocess.Popen(['cat', fn], stdout=subprocess.PIPE)
+        procs.append(c)
+        stdin = c.stdout
+    else:
+        argv = argv + [fn]
+    null = open(os.devnull, 'wb')
+    start = time.monotonic()
+    p = subprocess.Popen(argv, stdin=stdin,
+            stdout=subprocess.PIPE if out == 'pipe' else null)
+    if stdin:
+        stdin.close()
+    if out == 'pipe':
+        c = subprocess.Popen(['cat'], stdin=p.stdout, stdout=null)
+        p.stdout.close()
+        procs.append(c)
+    _, status, ru = os.wait4(p.pid, 0)
+    wall = time.monotonic() - start
+    p.returncode = os.waitstatus_to_exitcode(status)
+    for c in procs:
+        c.wait()
+    null.close()
+    return wall, ru, p.returncode
+
+def bench(args, d, writer):
+    size = parse_size(args.size)
+    print('{:<42} {:>9} {:>9}'.format('tag', 'MB/s', 'cpu ns/B'))
+    errors = 0
+    for name in args.corpora:
+        for codec in args.codecs:
+            if codec != 'none' and not shutil.which(codec):
+                print('{:<42} (not found)'.format(codec))
+                continue
+            fn = corpus(d, name, codec, size)
+            for inp in args.inputs:
+                for out in args.outputs:
+                    for b in args.buffers:
+                        for ex in ((False, True) if args.exec else (False,)):
+                            argv = [args.dcat, '-b', b] + (['--exec'] if ex else [])
+                            tag = '{}/{}/{}/{}/b{}{}'.format(name, codec, inp, out,
+                                    b, '/exec' if ex else '')
+                            mbs = []
+                            cpus = []
+                            for i in range(args.n):
+                                wall, ru, rc = measure(argv, fn, inp, out)
+                                errors += rc != 0
+                                cpu = ru.ru_utime + ru.ru_stime
+                                mbs.append(size / wall / 1e6)
+                                cpus.append(cpu / size * 1e9)
+                                if writer:
+                                    writer.writerow([tag, wall, ru.ru_utime,
+                                        ru.ru_stime, ru.ru_maxrss, mbs[-1], cpus[-1],
+                                        datetime.datetime.now().strftime('%Y-%m-%d %H:%M:%S'),
+                                        rc, args.dcat, str(argv[1:] + [inp, out, fn])])
+                            print('{:<42} {:>9.1f} {:>9.2f}'.format(tag,
+                                statistics.median(mbs), statistics.median(cpus)))
+    return errors
+
+def run(args, d):
+    if not args.raw:
+        return bench(args, d, None)
+    with open(args.raw, 'w', newline='') as f:
+        writer = csv.writer(f)
+        writer.writerow(['tag'] + list(items) + ['date', 'rc', 'cmd', 'args'])
+        return bench(args, d, writer)
+
+def main():
+    args = mk_arg_parser().parse_args()
+    if args.dir:
+        errors = run(args, args.dir)
+    else:
+        with tempfile.TemporaryDirectory() as d:
+            errors = run(args, d)
+    return int(errors != 0)
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+#
+# oldprocs unittests
+#
+# SPDX-License-Identifier: GPL-3.0-or-later
+
+import json
+import os
+import pytest
+import shutil
+import subprocess
+import sys
+import tempfile
+
+oldprocs = os.getenv('oldprocs', './oldprocs')
+
+# maps a few deleted files that don't indicate an update and
+# then waits for stdin to be closed
+mapper = r'''
+import ctypes, mmap, os, sys
+d = sys.argv[1]
+ms = []
+def mapfd(fd):
+    os.ftruncate(fd, 4096)
+    ms.append(mmap.mmap(fd, 4096))
+    os.close(fd)
+mapfd(os.memfd_create('oldprocs-test'))
+fn = '/dev/shm/oldprocs-test-{}'.format(os.getpid())
+mapfd(os.open(fn, os.O_RDWR | os.O_CREAT | os.O_EXCL, 0o600))
+os.unlink(fn)
+mapfd(os.open(d, os.O_RDWR | os.O_TMPFILE, 0o600))
+ms.append(mmap.mmap(-1, 4096, flags=mmap.MAP_SHARED))
+libc = ctypes.CDLL(None, use_errno=True)
+libc.shmat.restype = ctypes.c_void_p
+i = libc.shmget(0, 4096, 0o600)
+if i != -1:
+    libc.shmat(i, None, 0)
+    libc.shmctl(i, 0, None)   # i.e. IPC_RMID
+if len(sys.argv) > 2:
+    fn = d + '/data'
+    with open(fn, 'wb') as f:
+        f.write(b'x' * 4096)
+    mapfd(os.open(fn, os.O_RDWR))
+    os.unlink(fn)
+print('ready', flush=True)
+sys.stdin.read()
+'''
+
+def check_mapper(args, deleted=False):
+    with tempfile.TemporaryDirectory() as d:
+        cmd = [sys.executable, '-c', mapper, d] + (['deleted'] if deleted else [])
+        p = subprocess.Popen(cmd, stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                universal_newlines=True)
+        try:
+            assert p.stdout.readline() == 'ready\n'
+            o = subprocess.run([oldprocs, '--no-check-dm', '--json'] + args,
+                    stdout=subprocess.PIPE, universal_newlines=True,
+                    check=False).stdout
+        finally:
+            p.stdin.close()
+            p.wait()
+    rs = [ json.loads(l) for l in o.splitlines() ]
+    assert rs[-1]['type'] == 'summary'
+    return [ r for r in rs if r['type'] == 'process' and r['pid'] == p.pid ]
+
+@pytest.mark.parametrize('args', ([], ['--inode']))
+def test_anonymous_maps(args):
+    assert check_mapper(['--all-maps'] + args) == []
+
+@pytest.mark.parametrize('args', ([], ['--inode']))
+def test_deleted_maps(args):
+    rs = check_mapper(['--all-maps'] + args, deleted=True)
+    assert len(rs) == 1
+    assert rs[0]['reason'] == 'lib_deleted'
+    assert rs[0]['lib'].endswith('/data (deleted)')
+
+def changed_reasons(fn, replace):
+    p = subprocess.Popen([fn, '60'])
+    try:
+        if replace:
+            shutil.copy(fn, fn + '.new')
+            os.rename(fn + '.new', fn)
+        o = subprocess.run([oldprocs, '--no-check-dm', '--json',
+            '--changed-files', '-'], input=fn + '\n', stdout=subprocess.PIPE,
+            universal_newlines=True, check=False).stdout
+    finally:
+        p.kill()
+        p.wait()
+    rs = [ json.loads(l) for l in o.splitlines() ]
+    return [ r['reason'] for r in rs if r['type'] == 'process' and r['pid'] == p.pid ]
+
+# i.e. a listed file only counts if the process maps an old version of it,
+# e.g. not after a service restart
+def test_changed_files():
+    with tempfile.TemporaryDirectory() as d:
+        fn = d + '/sleep'
+        shutil.copy(shutil.which('sleep'), fn)
+        assert changed_reasons(fn, replace=False) == []
+        assert changed_reasons(fn, replace=True) == ['exe_changed']
+
+# i.e. the debug output doesn't end up between the JSON Lines records
+def test_json_verbose():
+    p = subprocess.run([oldprocs, '--no-check-dm', '--json', '-v'],
+            stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+            universal_newlines=True, check=False)
+    rs = [ json.loads(l) for l in p.stdout.splitlines() ]
+    assert [ r['type'] for r in rs ].count('summary') == 1
+    assert rs[-1]['type'] == 'summary'
+    assert all(r['recheck'] is False for r in rs if r['type'] == 'process')
+    assert '[dbg]' in p.stderr
@@ -0,0 +1,216 @@
+// pq_bench - microbenchmark the /proc parsing primitives of pq
+//
+// Replays captured /proc/$pid/{stat,status,io} files (cf. test/in/pq)
+// such that the results don't depend on the live process table
+// of the machine the benchmark runs on.
+//
+// Example:
+//
+//     $ ./pq_bench -n 100000 ../utility/test/in/pq
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// SPDX-FileCopyrightText: © 2026 Georg Sauthoff <mail@gms.tf>
+
+#define PQ_NO_MAIN
+#include "../pq.cc"
+
+
+// i.e. keep the compiler from optimizing the benchmarked calls away
+static volatile size_t sink;
+
+static vector<size_t> list_pids(const string &root)
+{
+    vector<size_t> pids;
+    ixxx::util::Directory dir(root);
+    for (const struct dirent *d = dir.read(); d; d = dir.read()) {
+        size_t pid = 0;
+        auto e = d->d_name + strlen(d->d_name);
+        auto r = from_chars(d->d_name, e, pid);
+        if (r.ec == std::errc() && r.ptr == e)
+            pids.push_back(pid);
+    }
+    sort(pids.begin(), pids.end());
+    return pids;
+}
+
+static string slurp(const string &filename)
+{
+    array<char, 4*1024> buf;
+    ixxx::util::FD fd(filename, O_RDONLY);
+    size_t n = ixxx::util::read_all(fd, buf);
+    return string(buf.data(), n);
+}
+
+static void report(const char *name, uint64_t ns, size_t n, const char *unit)
+{
+    printf("%-24s %10.1f %s\n", name, double(ns) / double(n), unit);
+}
+
+static void bench_primitives(const string &root, const vector<size_t> &pids,
+        size_t iterations)
+{
+    vector<string> stats;
+    vector<string> uid_lines;
+    for (auto pid : pids) {
+        auto base = root + to_string(pid);
+        stats.push_back(slurp(base + "/stat"));
+        auto status = slurp(base + "/status");
+        auto p = status.find("\nUid:");
+        auto e = status.find('\n', p + 1);
+        uid_lines.push_back(status.substr(p + 5, e - p - 5));
+    }
+
+    uint64_t a = now_ns();
+    for (size_t i = 0; i < iterations; ++i)
+        for (auto &s : uid_lines)
+            sink += nth_col(s, 1).size();
+    uint64_t b = now_ns();
+    report("nth_col", b - a, iterations * uid_lines.size(), "ns/op");
+
+    a = now_ns();
+    for (size_t i = 0; i < iterations; ++i)
+        for (auto &s : stats)
+            sink += fast_find(s.data(), s.data() + s.size(), '(') - s.data();
+    b = now_ns();
+    report("fast_find", b - a, iterations * stats.size(), "ns/op");
+
+    a = now_ns();
+    for (size_t i = 0; i < iterations; ++i)
+        for (auto &s : stats)
+            sink += fast_rfind(s.data(), s.data() + s.size(), ')') - s.data();
+    b = now_ns();
+    report("fast_rfind", b - a, iterations * stats.size(), "ns/op");
+}
+
+// NB: after the first access the file contents are cached in Process,
+// thus, the following iterations just measure the parsing of a field
+static void bench_fields(Process &proc, const vector<size_t> &pids,
+        size_t iterations)
+{
+    static const Column cols[] = {
+        // read_stat()
+        Column::MINFLT, Column::MAJFLT, Column::NICE, Column::CPU,
+        Column::RTPRIO, Column::CLS, Column::FLAGS,
+        // read_status()
+        Column::COMM, Column::STATE, Column::UID, Column::PPID,
+        Column::THREADS, Column::AFFINITY, Column::VCTX, Column::NVCTX,
+        Column::RSS, Column::VSIZE,
+        // read_io()
+        Column::RCHAR, Column::WCHAR, Column::SYSCR, Column::SYSCW,
+        Column::CWBYTE
+    };
+    for (auto c : cols) {
+        uint64_t t = 0;
+        for (auto pid : pids) {
+            proc.set_pid(pid, pid);
+            sink += proc.column(c).size();
+            uint64_t a = now_ns();
+            for (size_t i = 0; i < iterations; ++i)
+                sink += proc.column(c).size();
+            uint64_t b = now_ns();
+            t += b - a;
+        }
+        auto &h = col2header[static_cast<unsigned>(c)];
+        string name(h.data(), h.size());
+        report(name.c_str(), t, iterations * pids.size(), "ns/field");
+    }
+}
+
+struct Column_Set {
+    const char *name;
+    vector<Column> columns;
+};
+
+static void bench_rows(Process &proc, const vector<size_t> &pids,
+        size_t iterations)
+{
+    const Column_Set sets[] = {
+        { "rows:stat", { Column::PID, Column::TID, Column::CPU, Column::CLS,
+                   Column::RTPRIO, Column::NICE, Column::MINFLT, Column::MAJFLT,
+                   Column::FLAGS } },
+        { "rows:status", { Column::PID, Column::COMM, Column::STATE, Column::UID,
+                   Column::GID, Column::THREADS, Column::PPID, Column::AFFINITY,
+                   Column::VCTX, Column::NVCTX, Column::RSS, Column::VSIZE } },
+        { "rows:io", { Column::PID, Column::RCHAR, Column::WCHAR, Column::SYSCR,
+                   Column::SYSCW, Column::RBYTE, Column::WBYTE, Column::CWBYTE } },
+        { "rows:mixed", { Column::PID, Column::TID, Column::PPID,
+                   Column::AFFINITY, Column::CPU, Column::CLS, Column::RTPRIO,
+                   Column::NICE, Column::RSS, Column::RCHAR, Column::COMM } }
+    };
+    ixxx::util::File o("/dev/null", "w");
+    for (auto &set : sets) {
+        Args args;
+        args.columns = set.columns;
+        args.env_vars.resize(args.columns.size());
+        print_header(o, args);
+
+        // i.e. replicates the inner loop of main()
+        uint64_t a = now_ns();
+        for (size_t i = 0; i < iterations; ++i) {
+            for (auto pid : pids) {
+                proc.set_pid(pid, pid);
+                sink += proc.flags();
+                print_row(o, proc, args);
+            }
+        }
+        uint64_t b = now_ns();
+        size_t n = iterations * pids.size();
+        printf("%-24s %10.0f rows/s (%.1f ns/row)\n", set.name,
+                double(n) / (double(b - a) / 1e9), double(b - a) / double(n));
+    }
+}
+
+static void help(FILE *o)
+{
+    fprintf(o, "Usage: pq_bench [-n ITERATIONS] FIXTURE_DIR\n"
+            "\n"
+            "FIXTURE_DIR contains PID directories with stat, status and io files,\n"
+            "e.g. test/in/pq.\n");
+}
+
+int main(int argc, char **argv)
+{
+    size_t iterations = 10000;
+    int c = 0;
+    while ((c = getopt(argc, argv, "hn:")) != -1) {
+        switch (c) {
+            case 'h':
+                help(stdout);
+                return 0;
+            case 'n':
+                iterations = atol(optarg);
+                break;
+            default:
+                help(stderr);
+                return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        help(stderr);
+        return 1;
+    }
+    string root(argv[optind]);
+    if (root.back() != '/')
+        root.push_back('/');
+
+    try {
+        auto pids = list_pids(root);
+        if (pids.empty())
+            throw runtime_error("no PID directories found in fixture directory");
+
+        Process proc;
+        proc.set_root(root);
+        proc.boot_time_s = 0;
+        proc.clock_ticks = 100;
+
+        printf("%zu tasks, %zu iterations\n\n", pids.size(), iterations);
+        bench_primitives(root, pids, iterations);
+        bench_fields(proc, pids, iterations);
+        // rows also include reading the files, thus use fewer iterations
+        bench_rows(proc, pids, max(iterations / 100, size_t(1)));
+    } catch (const std::exception &e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -117,6 +117,23 @@ class Basic(unittest.TestCase):
     self.assertEqual(e, b'')
     self.assertEqual(p.returncode, 1)
 
+  # i.e. the output is copied to a regular file and to one opened
+  # with O_APPEND
+  def test_out_file(self):
+    with tempfile.TemporaryDirectory() as d:
+      fn = d + '/out'
+      x = ''.join('{}\n'.format(i) for i in range(100000)).encode()
+      with open(fn, 'wb') as f:
+        code = subprocess.call([self.silence, 'sh', '-c',
+          'seq 0 99999; exit 2'], stdout=f)
+      self.assertEqual(code, 2)
+      with open(fn, 'ab') as f:
+        code = subprocess.call([self.silence, 'sh', '-c',
+          'seq 0 99999; exit 3'], stdout=f)
+      self.assertEqual(code, 3)
+      with open(fn, 'rb') as f:
+        self.assertEqual(f.read(), x + x)
+
   def test_opt_ordering(self):
     p = subprocess.Popen([self.silence, echo, '-k', '1', '23'],
         stdout=subprocess.PIPE, stderr=subprocess.PIPE)
@@ -223,10 +240,141 @@ class Basic(unittest.TestCase):
     self.assertFalse(t.was_still_running)
 
 # using inheritence for parametrizing the above tests
-# for the C++ version
+# for the other name
 class BasicXX(Basic):
   silence = silence.replace('silence', 'silencce')
 
+class CaptureXX(unittest.TestCase):
+
+  silence = silence.replace('silence', 'silencce')
+
+  def run_silence(self, args, tmpdir=None):
+    env = dict(os.environ)
+    if tmpdir:
+      env['TMPDIR'] = tmpdir
+    p = subprocess.Popen([self.silence] + args, env=env,
+        stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    o, e = p.communicate()
+    return p.returncode, o, e
+
+  def test_out(self):
+    code, o, e = self.run_silence(['-m', '1M', echo, 'Hello World\n23', '1', '1'])
+    self.assertEqual(o, b'Hello World\n23\n')
+    self.assertEqual(e, b'')
+    self.assertEqual(code, 1)
+
+  def test_err(self):
+    code, o, e = self.run_silence(['-m', '1M', echo, 'Hello World\n23', '2', '5'])
+    self.assertEqual(o, b'')
+    self.assertEqual(e, b'Hello World\n23\n')
+    self.assertEqual(code, 5)
+
+  # i.e. without spilling, no temporary file is created
+  def test_no_tmpfile(self):
+    code, o, e = self.run_silence(['-m', '1M', echo, 'Foo', '1', '0'],
+        '/does/not/exist/like/never/ever')
+    self.assertEqual(code, 0)
+    self.assertEqual(o, b'')
+    self.assertEqual(e, b'')
+
+  def test_spill(self):
+    code, o, e = self.run_silence(['-m', '1K', 'seq', '10000'],
+        '/does/not/exist/like/never/ever')
+    self.assertEqual(code, 1)
+    self.assertTrue(b'No such file or directory' in e)
+    with tempfile.TemporaryDirectory() as d:
+      code, o, e = self.run_silence(['-m', '1K', 'sh', '-c',
+        'seq 10000; seq 5 >&2; exit 3'], d)
+      self.assertFalse(os.listdir(d))
+    self.assertEqual(code, 3)
+    self.assertEqual(o, ''.join('{}\n'.format(i) for i in range(1, 10001)).encode())
+    self.assertEqual(e, b'1\n2\n3\n4\n5\n')
+
+  def test_interleave(self):
+    cmd = ('for i in 1 2 3; do echo out$i; sleep 0.05; echo err$i >&2;'
+        ' sleep 0.05; done; exit 4')
+    for m in ([], ['-m', '1M'], ['-m', '10']):
+      p = subprocess.run([self.silence, '-i'] + m + ['sh', '-c', cmd],
+          stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+      self.assertEqual(p.returncode, 4)
+      self.assertEqual(p.stdout, b'out1\nerr1\nout2\nerr2\nout3\nerr3\n')
+    code, o, e = self.run_silence(['-i', 'sh', '-c', cmd])
+    self.assertEqual(o, b'out1\nout2\nout3\n')
+    self.assertEqual(e, b'err1\nerr2\nerr3\n')
+    code, o, e = self.run_silence(['-i', 'sh', '-c', 'echo foo; echo bar >&2'])
+    self.assertEqual(code, 0)
+    self.assertEqual(o, b'')
+    self.assertEqual(e, b'')
+
+  def test_timestamps(self):
+    code, o, e = self.run_silence(['-t', 'sh', '-c',
+      'echo foo; printf "bar"; sleep 0.05; echo baz; exit 1'])
+    self.assertEqual(code, 1)
+    ts = rb'\d{4}-\d\d-\d\d \d\d:\d\d:\d\d\.\d{6} '
+    self.assertRegex(o, b'^' + ts + b'foo\n' + ts + b'barbaz\n$')
+
+  def test_tail(self):
+    cmd = 'seq 100000; seq 5 >&2; exit 3'
+    code, o, e = self.run_silence(['--tail-lines', '3', 'sh', '-c', cmd],
+        '/does/not/exist/like/never/ever')
+    self.assertEqual(code, 3)
+    self.assertEqual(o, b'[silence: 588876 bytes omitted]\n99998\n99999\n100000\n')
+    self.assertEqual(e, b'[silence: 4 bytes omitted]\n3\n4\n5\n')
+    code, o, e = self.run_silence(['--tail-lines', '2', '--head', '2', 'sh', '-c', cmd])
+    self.assertEqual(o, b'1\n2\n[silence: 588878 bytes omitted]\n99999\n100000\n')
+    self.assertEqual(e, b'1\n2\n[silence: 2 bytes omitted]\n4\n5\n')
+    code, o, e = self.run_silence(['--tail-bytes', '10', '--head', '5', 'sh', '-c', cmd])
+    self.assertEqual(o, b'1\n2\n3\n[silence: 588880 bytes omitted]\n99\n100000\n')
+    self.assertEqual(e, b'1\n2\n3\n4\n5\n')
+    code, o, e = self.run_silence(['--tail-lines', '3', 'sh', '-c', 'seq 3; exit 1'])
+    self.assertEqual(o, b'1\n2\n3\n')
+    code, o, e = self.run_silence(['--tail-lines', '3', 'seq', '100000'])
+    self.assertEqual(code, 0)
+    self.assertEqual(o, b'')
+
+  def test_not_found(self):
+    for args in ([], ['-m', '1M'], ['-i'], ['--tail-lines', '3']):
+      code, o, e = self.run_silence(args + ['/does/not/exist/command'])
+      self.assertEqual(code, 127)
+      self.assertIn(b'executing command', e)
+
+  # i.e. a background process that keeps the pipes open isn't waited for
+  def test_descendant(self):
+    for args in (['-m', '1M'], ['-i'], ['--tail-lines', '3']):
+      begin = timeit.default_timer()
+      code, o, e = self.run_silence(args + ['sh', '-c',
+          'sleep 10 & echo foo; echo bar >&2; exit 3'])
+      end = timeit.default_timer()
+      self.assertTrue(end-begin < 5)
+      self.assertEqual(code, 3)
+      self.assertEqual(o, b'foo\n')
+      self.assertEqual(e, b'bar\n')
+
+  def test_timeout(self):
+    begin = timeit.default_timer()
+    code, o, e = self.run_silence(['--timeout', '1', 'sh', '-c', 'echo foo; sleep 10'])
+    end = timeit.default_timer()
+    self.assertTrue(end-begin < 5)
+    self.assertEqual(code, 124)
+    self.assertEqual(o, b'foo\n')
+    self.assertIn(b'timed out', e)
+    # i.e. a command that exits with 0 on TERM still times out
+    code, o, e = self.run_silence(['--timeout', '1', 'sh', '-c',
+        'trap "exit 0" TERM; echo foo; sleep 10 & wait'])
+    self.assertEqual(code, 124)
+    self.assertEqual(o, b'foo\n')
+    # i.e. a background process that keeps the pipes open
+    begin = timeit.default_timer()
+    code, o, e = self.run_silence(['--timeout', '1', '-m', '1M', 'sh', '-c',
+        'sleep 10 & echo foo; sleep 10'])
+    end = timeit.default_timer()
+    self.assertTrue(end-begin < 5)
+    self.assertEqual(code, 124)
+    self.assertEqual(o, b'foo\n')
+    code, o, e = self.run_silence(['--timeout', '10', 'sh', '-c', 'echo foo'])
+    self.assertEqual(code, 0)
+    self.assertEqual(o, b'')
+
 if __name__ == '__main__':
     unittest.main()
 